@@ -22,10 +22,444 @@
  */
 
 #include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "i3lock.h"
 #include "blur.h"
-/* Performs a simple 2D Gaussian blur of standard devation @sigma surface @surface. */
+
+extern bool debug_mode;
+
+typedef void (*blur_pass_func_t)(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size);
+
+/* The fixed-size box kernel used for this CPU, see blur_select_kernel. */
+static blur_pass_func_t blur_kernel = NULL;
+static const char *blur_kernel_name = NULL;
+
+/* State shared by all threads working on one blur_image_surface call. */
+typedef struct {
+    uint32_t *src, *dst;
+    int width, height;
+
+    /* number of passes of the fixed-size box kernels of the given widths,
+     * or BOX_PASSES sliding-window passes with the given radii, or a single
+     * recursive pass with the given coefficients */
+    int passes;
+    int sizes[MAX_KERNEL_PASSES];
+    bool box;
+    int radii[BOX_PASSES];
+    bool iir;
+    float coefficients[3];
+    // applied by the last pass, NULL if there are none
+    const blur_effects_t *effects;
+    // if not 0, pixelate_image_surface averages blocks of this size instead
+    // of blurring, see pixelate_bands
+    int block;
+
+    int threads;
+    /* held while the workers are being spawned, so that they only start once
+     * the final number of threads is known */
+    pthread_mutex_t start;
+    pthread_barrier_t barrier;
+} blur_job_t;
+
+typedef struct {
+    blur_job_t *job;
+    int index;
+} blur_worker_t;
+
+/*
+ * Computes the radii of @passes box filters which, applied one after another,
+ * approximate a Gaussian blur of standard deviation @sigma.
+ *
+ * The ideal box width is sqrt(12*σ²/n + 1); since box widths have to be odd,
+ * we use the two odd widths around it and pick how many passes use the
+ * smaller one so that the resulting σ is as close as possible. See [1] in
+ * blur_image_surface.
+ */
+static void box_blur_radii(int sigma, int *radii, int passes) {
+    double w_ideal = sqrt(12.0 * sigma * sigma / passes + 1);
+    int wl = floor(w_ideal);
+    if (wl % 2 == 0)
+        wl--;
+    int wu = wl + 2;
+
+    double m_ideal = (12.0 * sigma * sigma - passes * wl * wl - 4.0 * passes * wl - 3.0 * passes) / (-4.0 * wl - 4);
+    int m = lrint(m_ideal);
+
+    for (int i = 0; i < passes; i++)
+        radii[i] = ((i < m ? wl : wu) - 1) / 2;
+}
+
+/*
+ * Computes the coefficients of the recursive Gaussian filter of standard
+ * deviation @sigma described in [1]: b1, b2 and b3, all divided by b0. The
+ * filter does not use B, see blur_impl_horizontal_pass_iir.
+ *
+ * [1]: I. T. Young, L. J. van Vliet, "Recursive implementation of the
+ *      Gaussian filter", Signal Processing 44 (1995)
+ */
+void blur_iir_coefficients(int sigma, float coefficients[3]) {
+    // the approximation of q only holds from sigma 0.5 on
+    double s = sigma < 1 ? 1 : sigma;
+    double q = s >= 2.5 ? 0.98711 * s - 0.96330
+                        : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * s);
+
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+    double b1 = 2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q;
+    double b2 = -(1.4281 * q * q + 1.26661 * q * q * q);
+    double b3 = 0.422205 * q * q * q;
+
+    coefficients[0] = b1 / b0;
+    coefficients[1] = b2 / b0;
+    coefficients[2] = b3 / b0;
+}
+
+/* Widths of the fixed-size box kernels, see BLUR_SPECIALIZE. */
+static const int kernel_sizes[] = {3, 5, 7, 9, 15, 31};
+
+/*
+ * Like box_blur_radii, but picks the widths from the ones the fixed-size
+ * kernels exist for: some passes use the widest of them narrower than the
+ * ideal width, the others the next wider one. Returns the number of passes,
+ * or 0 if sliding-window passes are the better (or, for images narrower than
+ * the kernels, the only) option.
+ *
+ * The kernel widths are far apart, so BOX_PASSES passes can miss @sigma by
+ * quite a bit; up to MAX_KERNEL_PASSES passes are tried to get within
+ * KERNEL_TOLERANCE of it.
+ */
+static int blur_kernel_sizes(int sigma, int width, int height, int *sizes) {
+    const int count = sizeof(kernel_sizes) / sizeof(kernel_sizes[0]);
+    // every pass of width w adds (w*w-1)/12 to σ²
+    const double variance = 12.0 * sigma * sigma;
+    double best_error = INFINITY;
+    int best_passes = 0;
+
+    for (int passes = BOX_PASSES; passes <= MAX_KERNEL_PASSES; passes++) {
+        const double w_ideal = sqrt(variance / passes + 1);
+        int wl = kernel_sizes[0], wu = kernel_sizes[0];
+        for (int i = 0; i < count && kernel_sizes[i] <= w_ideal; i++) {
+            wl = kernel_sizes[i];
+            wu = kernel_sizes[i + 1 < count ? i + 1 : i];
+        }
+
+        // m passes of wl and the rest of wu get closest to σ²
+        int m = passes;
+        if (wl != wu) {
+            m = lrint((passes * (wu * wu - 1) - variance) / (wu * wu - wl * wl));
+            m = m < 0 ? 0 : m > passes ? passes : m;
+        }
+
+        double sigma_n = sqrt((m * (wl * wl - 1) + (passes - m) * (wu * wu - 1)) / 12.0);
+        if (fabs(sigma_n - sigma) < best_error) {
+            best_error = fabs(sigma_n - sigma);
+            best_passes = passes;
+            for (int i = 0; i < passes; i++)
+                sizes[i] = i < m ? wl : wu;
+        }
+        if (best_error <= KERNEL_TOLERANCE * sigma)
+            break;
+    }
+
+    // sigmas below what the narrowest kernel does are fine, nothing else
+    // would get any closer
+    if (best_error > KERNEL_TOLERANCE * sigma && sizes[0] != kernel_sizes[0])
+        return 0;
+
+    for (int i = 0; i < best_passes; i++) {
+        // the border handling needs the whole kernel to fit into a row
+        if (sizes[i] > width || sizes[i] > height)
+            return 0;
+    }
+    return best_passes;
+}
+
+/* Returns true if @effects is not NULL and changes any pixel. */
+bool blur_effects_enabled(const blur_effects_t *effects) {
+    return effects != NULL &&
+           (effects->grayscale || effects->tint_alpha > 0 || effects->dim > 0 || effects->noise > 0);
+}
+
+/*
+ * Copies @effects to @prepared and fills in its table. Returns @prepared, or
+ * NULL if there are no effects to apply.
+ */
+static const blur_effects_t *blur_effects_prepare(const blur_effects_t *effects, blur_effects_t *prepared) {
+    if (!blur_effects_enabled(effects))
+        return NULL;
+
+    *prepared = *effects;
+    for (int channel = 0; channel < 3; channel++) {
+        const int tint = effects->tint >> (16 - 8 * channel) & 0xFF;
+        const int a = effects->tint_alpha > 0 ? effects->tint_alpha : 0;
+        const int dim = effects->dim > 0 ? effects->dim : 0;
+        for (int c = 0; c < 256; c++) {
+            int v = (c * (255 - a) + tint * a + 127) / 255;
+            prepared->table[channel][c] = (v * (255 - dim) + 127) / 255;
+        }
+    }
+    return prepared;
+}
+
+static inline int blur_clamp_channel(int c) {
+    return c < 0 ? 0 : c > 255 ? 255 : c;
+}
+
+/*
+ * Computes the grain of the TILE_SIZE pixels starting at position @index of
+ * the image: an integer hash (lowbias32) of the position, so that it does not
+ * depend on the order or the thread the pixels are stored in. Kept apart
+ * from blur_apply_effects, and always TILE_SIZE long, so that the compiler
+ * vectorizes it.
+ */
+static inline void blur_effects_grain(const blur_effects_t *effects, uint32_t index, int grain[TILE_SIZE]) {
+    const uint32_t range = 2 * effects->noise + 1;
+    for (int i = 0; i < TILE_SIZE; i++) {
+        uint32_t h = index + i;
+        h ^= h >> 16;
+        h *= 0x7feb352d;
+        h ^= h >> 15;
+        h *= 0x846ca68b;
+        h ^= h >> 16;
+        // 16 bit of the hash times range stays within 32 bit
+        grain[i] = (int)(((h >> 16) * range) >> 16) - effects->noise;
+    }
+}
+
+/*
+ * Applies @effects, prepared by blur_effects_prepare, to pixel @p, adding
+ * @grain (see blur_effects_grain) to every channel if there is noise. Alpha
+ * is left untouched.
+ */
+static inline uint32_t blur_apply_effects(const blur_effects_t *effects, uint32_t p, int grain) {
+    int r = p >> 16 & 0xFF, g = p >> 8 & 0xFF, b = p & 0xFF;
+
+    if (effects->grayscale)
+        r = g = b = (77 * r + 150 * g + 29 * b + 128) >> 8;
+    r = effects->table[0][r];
+    g = effects->table[1][g];
+    b = effects->table[2][b];
+    if (effects->noise > 0) {
+        // the same grain for all channels, so that it stays colorless
+        r = blur_clamp_channel(r + grain);
+        g = blur_clamp_channel(g + grain);
+        b = blur_clamp_channel(b + grain);
+    }
+
+    return (p & 0xFF000000) | (uint32_t)r << 16 | (uint32_t)g << 8 | (uint32_t)b;
+}
+
+/*
+ * Runs one horizontal pass over rows [row_start, row_end) of @src.
+ *
+ * horizontal pass includes image transposition:
+ * instead of writing pixel src[x] to dst[x],
+ * we write it to transposed location.
+ * (to be exact: dst[height * current_column + current_row])
+ */
+static void blur_pass(blur_job_t *job, int pass, uint32_t *src, uint32_t *dst,
+                      int width, int height, int row_start, int row_end, const blur_effects_t *effects) {
+    if (job->box) {
+        blur_impl_horizontal_pass_box(src, dst, width, height, row_start, row_end, effects, job->radii[pass]);
+        return;
+    }
+    if (job->iir) {
+        blur_impl_horizontal_pass_iir(src, dst, width, height, row_start, row_end, effects, job->coefficients);
+        return;
+    }
+    blur_kernel(src, dst, width, height, row_start, row_end, effects, job->sizes[pass]);
+}
+
+/*
+ * Picks the fastest fixed-size box kernel the CPU supports, unless one was
+ * forced with blur_set_kernel. Runs once, before any worker threads are started.
+ */
+static void blur_select_kernel(void) {
+    static bool selected = false;
+    if (selected)
+        return;
+    selected = true;
+
+    if (!blur_kernel) {
+#ifdef BLUR_RUNTIME_DISPATCH
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw")) {
+            blur_kernel = blur_impl_horizontal_pass_avx512bw;
+            blur_kernel_name = "AVX-512BW";
+        } else if (__builtin_cpu_supports("avx2")) {
+            blur_kernel = blur_impl_horizontal_pass_avx2;
+            blur_kernel_name = "AVX2";
+        } else {
+            blur_kernel = blur_impl_horizontal_pass_sse2;
+            blur_kernel_name = "SSE2";
+        }
+#elif defined(__SSE2__)
+        blur_kernel = blur_impl_horizontal_pass_sse2;
+        blur_kernel_name = "SSE2";
+#else
+        blur_kernel = blur_impl_horizontal_pass_vector;
+        blur_kernel_name = "vector";
+#endif
+    }
+    DEBUG("using the %s blur kernel\n", blur_kernel_name);
+}
+
+/*
+ * Forces the fixed-size box kernel called @name ("avx512bw", "avx2", "sse2",
+ * "vector" or "generic") instead of the one blur_select_kernel would pick.
+ * Returns false if there is no such kernel in this build or the CPU doesn't
+ * support it.
+ */
+bool blur_set_kernel(const char *name) {
+#ifdef BLUR_RUNTIME_DISPATCH
+    __builtin_cpu_init();
+    if (strcmp(name, "avx512bw") == 0) {
+        if (!__builtin_cpu_supports("avx512bw"))
+            return false;
+        blur_kernel = blur_impl_horizontal_pass_avx512bw;
+        blur_kernel_name = "AVX-512BW";
+        return true;
+    }
+    if (strcmp(name, "avx2") == 0) {
+        if (!__builtin_cpu_supports("avx2"))
+            return false;
+        blur_kernel = blur_impl_horizontal_pass_avx2;
+        blur_kernel_name = "AVX2";
+        return true;
+    }
+#endif
+#ifdef __SSE2__
+    if (strcmp(name, "sse2") == 0) {
+        blur_kernel = blur_impl_horizontal_pass_sse2;
+        blur_kernel_name = "SSE2";
+        return true;
+    }
+#endif
+    if (strcmp(name, "vector") == 0) {
+        blur_kernel = blur_impl_horizontal_pass_vector;
+        blur_kernel_name = "vector";
+        return true;
+    }
+    if (strcmp(name, "generic") == 0) {
+        blur_kernel = blur_impl_horizontal_pass_generic;
+        blur_kernel_name = "generic";
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Does the share of thread @index of every pass. Rows of each pass are
+ * independent, so the only synchronization needed is waiting for all threads
+ * to finish a pass before the transposed result is read by the next one.
+ */
+static void pixelate_bands(blur_job_t *job, int band_start, int band_end);
+
+static void blur_run(blur_job_t *job, int index) {
+    if (job->block) {
+        // bands of job->block rows are independent of each other
+        const int bands = (job->height + job->block - 1) / job->block;
+        pixelate_bands(job, (long)bands * index / job->threads, (long)bands * (index + 1) / job->threads);
+        return;
+    }
+
+    const int rows_start = (long)job->height * index / job->threads;
+    const int rows_end = (long)job->height * (index + 1) / job->threads;
+    const int columns_start = (long)job->width * index / job->threads;
+    const int columns_end = (long)job->width * (index + 1) / job->threads;
+
+    for (int i = 0; i < job->passes; i++) {
+        blur_pass(job, i, job->src, job->dst, job->width, job->height, rows_start, rows_end, NULL);
+        if (job->threads > 1)
+            pthread_barrier_wait(&job->barrier);
+
+        // the effects go into the last store of every pixel
+        blur_pass(job, i, job->dst, job->src, job->height, job->width, columns_start, columns_end,
+                  i + 1 == job->passes ? job->effects : NULL);
+        if (job->threads > 1 && i + 1 < job->passes)
+            pthread_barrier_wait(&job->barrier);
+    }
+}
+
+static void *blur_worker(void *arg) {
+    blur_worker_t *worker = arg;
+
+    pthread_mutex_lock(&worker->job->start);
+    pthread_mutex_unlock(&worker->job->start);
+
+    blur_run(worker->job, worker->index);
+    return NULL;
+}
+
+/*
+ * Splits the passes of @job across @threads threads (the calling thread being
+ * one of them). If @threads is not positive, one thread per online CPU is
+ * used. Falls back to fewer threads if they cannot be created.
+ */
+static void blur_run_threads(blur_job_t *job, int threads) {
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    // every thread needs at least one row in both directions
+    if (threads > job->width)
+        threads = job->width;
+    if (threads > job->height)
+        threads = job->height;
+    if (threads < 1)
+        threads = 1;
+
+    pthread_t *ids = NULL;
+    blur_worker_t *workers = NULL;
+    if (threads > 1) {
+        ids = calloc(threads, sizeof(pthread_t));
+        workers = calloc(threads, sizeof(blur_worker_t));
+        if (!ids || !workers)
+            threads = 1;
+    }
+
+    int spawned = 0;
+    if (threads > 1) {
+        pthread_mutex_init(&job->start, NULL);
+        pthread_mutex_lock(&job->start);
+        for (int i = 1; i < threads; i++) {
+            workers[i].job = job;
+            workers[i].index = i;
+            if (pthread_create(&ids[i], NULL, blur_worker, &workers[i]) != 0)
+                break;
+            spawned++;
+        }
+    }
+
+    job->threads = spawned + 1;
+    if (job->threads > 1)
+        pthread_barrier_init(&job->barrier, NULL, job->threads);
+    if (threads > 1)
+        pthread_mutex_unlock(&job->start);
+
+    blur_run(job, 0);
+
+    for (int i = 1; i <= spawned; i++)
+        pthread_join(ids[i], NULL);
+    if (job->threads > 1)
+        pthread_barrier_destroy(&job->barrier);
+    if (threads > 1)
+        pthread_mutex_destroy(&job->start);
+
+    free(ids);
+    free(workers);
+}
+
+/*
+ * Performs a simple 2D Gaussian blur of standard devation @sigma surface @surface,
+ * using @threads threads (or one per online CPU if @threads is not positive)
+ * and the given @engine, then applies @effects (which may be NULL).
+ */
 void
-blur_image_surface (cairo_surface_t *surface, int sigma)
+blur_image_surface (cairo_surface_t *surface, int sigma, int threads, blur_engine_t engine, const blur_effects_t *effects)
 {
     cairo_surface_t *tmp;
     int width, height;
@@ -48,6 +482,7 @@ blur_image_surface (cairo_surface_t *surface, int sigma)
      * factor of 4 - this is safe since we know that stride has to be a
      * multiple of uint32_t. */
     width /= 4;
+    effects = NULL;
     break;
 
     case CAIRO_FORMAT_RGB24:
@@ -64,86 +499,708 @@ blur_image_surface (cairo_surface_t *surface, int sigma)
 
     // according to a paper by Peter Kovesi [1], box filter of width w, equals to Gaussian blur of following sigma:
     // σ_av = sqrt((w*w-1)/12)
-    // for our 7x7 filter we have σ_av = 2.0.
-    // applying the same Gaussian filter n times results in σ_n = sqrt(n*σ_av*σ_av) [2]
-    // after some trivial math, we arrive at n = ((σ_d)/(σ_av))^2
+    // e.g. for a 7x7 filter we have σ_av = 2.0.
+    // applying Gaussian filters one after another adds up their σ² [2],
+    // so n passes of a 7x7 filter result in σ_n = sqrt(n*σ_av*σ_av)
     // since it's a box blur filter, n >= 3
     //
     // [1]: http://www.peterkovesi.com/papers/FastGaussianSmoothing.pdf
     // [2]: https://en.wikipedia.org/wiki/Gaussian_blur#Mathematics
 
-    int n = lrintf((sigma*sigma)/(SIGMA_AV*SIGMA_AV));
-    if (n < 3) n = 3;
+    blur_job_t job = {
+        .src = src,
+        .dst = dst,
+        .width = width,
+        .height = height,
+        .box = false,
+    };
+    blur_effects_t prepared;
+    job.effects = blur_effects_prepare(effects, &prepared);
+    job.passes = blur_kernel_sizes(sigma, width, height, job.sizes);
 
-    for (int i = 0; i < n; i++)
-    {
-        // horizontal pass includes image transposition:
-        // instead of writing pixel src[x] to dst[x],
-        // we write it to transposed location.
-        // (to be exact: dst[height * current_column + current_row])
-#ifdef __SSE2__
-        blur_impl_horizontal_pass_sse2(src, dst, width, height);
-        blur_impl_horizontal_pass_sse2(dst, src, height, width);
-#else
-        blur_impl_horizontal_pass_generic(src, dst, width, height);
-        blur_impl_horizontal_pass_generic(dst, src, height, width);
-#endif
+    if (engine == BLUR_ENGINE_IIR) {
+        // the recursive filter is a Gaussian in a single pass
+        job.passes = 1;
+        job.iir = true;
+        blur_iir_coefficients(sigma, job.coefficients);
+    } else if (job.passes == 0) {
+        // past a few passes of the widest fixed-size kernel, more passes
+        // only make the blur slower. switch to BOX_PASSES sliding-window
+        // passes instead, whose cost doesn't depend on the box width.
+        job.passes = BOX_PASSES;
+        job.box = true;
+        box_blur_radii(sigma, job.radii, BOX_PASSES);
     }
 
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    blur_select_kernel();
+    blur_run_threads(&job, threads);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    DEBUG("blurred %dx%d pixels with sigma %d (%d %s passes%s) in %.1f ms\n", width, height, sigma,
+          job.passes, job.iir ? "iir" : job.box ? "sliding-window box" : "fixed-size box",
+          job.effects ? ", with effects" : "",
+          (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
     cairo_surface_destroy (tmp);
     cairo_surface_flush (surface);
     cairo_surface_mark_dirty (surface);
 }
 
-void blur_impl_horizontal_pass_generic(uint32_t *src, uint32_t *dst, int width, int height) {
-		uint32_t *o_src = src;
-    for (int row = 0; row < height; row++) {
-        for (int column = 0; column < width; column++, src++) {
-            uint32_t rgbaIn[KERNEL_SIZE + 1];
-
-            // handle borders
-            int leftBorder = column < HALF_KERNEL;
-            int rightBorder = column > width - HALF_KERNEL;
-            int i = 0;
-            if (leftBorder) {
-                // for kernel size 7x7 and column == 0, we have:
-                // x x x P0 P1 P2 P3
-                // first loop mirrors P{0..3} to fill x's,
-                // second one loads P{0..3}
-                for (; i < HALF_KERNEL - column; i++)
-                    rgbaIn[i] = *(src + (HALF_KERNEL - i));
-                for (; i < KERNEL_SIZE; i++)
-                    rgbaIn[i] = *(src - (HALF_KERNEL - i));
-            } else if (rightBorder) {
-                for (; i < width - column; i++)
-                    rgbaIn[i] = *(src + i);
-                for (int k = 0; i < KERNEL_SIZE; i++, k++)
-                    rgbaIn[i] = *(src - k);
-            } else {
-                for (; i < KERNEL_SIZE; i++) {
-                    if ((uintptr_t) ((src + 4*i - HALF_KERNEL) + 1)
-                            > (uintptr_t) (o_src + (height * width)))
+/* Spreads the 4 channels of a pixel over the 16 bit lanes of an uint64_t. */
+static inline uint64_t pyramid_expand(uint32_t p) {
+    return (uint64_t)(p & 0xFF000000) << 24 |
+           (uint64_t)(p & 0x00FF0000) << 16 |
+           (uint64_t)(p & 0x0000FF00) << 8 |
+           (uint64_t)(p & 0x000000FF);
+}
+
+/* Inverse of pyramid_expand, for lanes that hold values up to 255. */
+static inline uint32_t pyramid_pack(uint64_t p) {
+    return (uint32_t)(p >> 24 & 0xFF000000) |
+           (uint32_t)(p >> 16 & 0x00FF0000) |
+           (uint32_t)(p >> 8 & 0x0000FF00) |
+           (uint32_t)(p & 0x000000FF);
+}
+
+/* Interpolates each channel between @a and @b, @weight being out of 256. */
+static inline uint64_t pyramid_lerp(uint64_t a, uint64_t b, int weight) {
+    // every lane stays below 256 * 256, so lanes never carry into each other
+    return ((a * (256 - weight) + b * weight + 0x0080008000800080) >> 8) & 0x00FF00FF00FF00FF;
+}
+
+/*
+ * Box-downsamples @src by @factor into @dst, averaging each channel over a
+ * block of @factor x @factor pixels (or fewer, at the right and bottom edge).
+ */
+static void pyramid_downsample(uint32_t *src, int width, int height,
+                               uint32_t *dst, int dst_width, int dst_height, int factor) {
+    for (int y = 0; y < dst_height; y++) {
+        const int y0 = y * factor;
+        const int y1 = y0 + factor < height ? y0 + factor : height;
+        for (int x = 0; x < dst_width; x++) {
+            const int x0 = x * factor;
+            const int x1 = x0 + factor < width ? x0 + factor : width;
+            const uint32_t count = (y1 - y0) * (x1 - x0);
+            // at most 16 pixels of 8 bit each per lane
+            uint64_t acc = 0;
+
+            for (int sy = y0; sy < y1; sy++)
+                for (int sx = x0; sx < x1; sx++)
+                    acc += pyramid_expand(src[sy * width + sx]);
+
+            uint32_t out = 0;
+            for (int shift = 0; shift < 32; shift += 8)
+                out |= ((uint32_t)(acc >> (2 * shift) & 0xFFFF) + count / 2) / count << shift;
+            dst[y * dst_width + x] = out;
+        }
+    }
+}
+
+/*
+ * Maps pixel @i of the upsampled image to the two pixels of the downsampled
+ * one it lies between, and the weight (out of 256) of the second one.
+ */
+static void pyramid_sample_position(int i, int factor, int size, int *i0, int *i1, int *weight) {
+    // pixel centers: i + 0.5 in the big image is (i + 0.5) / factor in the
+    // small one, i.e. (2i + 1 - factor) / (2 * factor) in pixel indices
+    int pos = ((2 * i + 1 - factor) * 256) / (2 * factor);
+    if (pos < 0)
+        pos = 0;
+    if (pos > (size - 1) * 256)
+        pos = (size - 1) * 256;
+
+    *i0 = pos / 256;
+    *i1 = *i0 + 1 < size ? *i0 + 1 : *i0;
+    *weight = pos % 256;
+}
+
+/*
+ * Bilinearly upsamples @src, which was downsampled by @factor, back into
+ * @dst, applying @effects (if not NULL) on the way. Returns false, leaving
+ * @dst untouched, if it runs out of memory.
+ */
+static bool pyramid_upsample(uint32_t *src, int src_width, int src_height,
+                             uint32_t *dst, int width, int height, int factor,
+                             const blur_effects_t *effects) {
+    int *columns = malloc(3 * width * sizeof(int));
+    // rows of @src, interpolated horizontally to @width pixels. consecutive
+    // rows of @src go to alternating slots, so that both rows the current
+    // output row lies between are available and each is only expanded once.
+    uint64_t *rows = malloc(2 * width * sizeof(uint64_t));
+    int cached[2] = {-1, -1};
+    bool done = false;
+    if (!columns || !rows)
+        goto out;
+
+    for (int x = 0; x < width; x++)
+        pyramid_sample_position(x, factor, src_width, &columns[3 * x], &columns[3 * x + 1], &columns[3 * x + 2]);
+
+    for (int y = 0; y < height; y++) {
+        int ys[2], wy;
+        pyramid_sample_position(y, factor, src_height, &ys[0], &ys[1], &wy);
+
+        for (int i = 0; i < 2; i++) {
+            const int slot = ys[i] % 2;
+            if (cached[slot] == ys[i])
+                continue;
+            uint32_t *line = src + ys[i] * src_width;
+            uint64_t *expanded = rows + slot * width;
+            for (int x = 0; x < width; x++)
+                expanded[x] = pyramid_lerp(pyramid_expand(line[columns[3 * x]]),
+                                           pyramid_expand(line[columns[3 * x + 1]]),
+                                           columns[3 * x + 2]);
+            cached[slot] = ys[i];
+        }
+
+        uint64_t *top = rows + (ys[0] % 2) * width;
+        uint64_t *bottom = rows + (ys[1] % 2) * width;
+        if (effects) {
+            int grain[TILE_SIZE] = {0};
+            for (int x = 0; x < width; x += TILE_SIZE) {
+                const int count = width - x < TILE_SIZE ? width - x : TILE_SIZE;
+                if (effects->noise > 0)
+                    blur_effects_grain(effects, y * width + x, grain);
+                for (int i = 0; i < count; i++)
+                    dst[y * width + x + i] = blur_apply_effects(effects, pyramid_pack(pyramid_lerp(top[x + i], bottom[x + i], wy)),
+                                                                grain[i]);
+            }
+        } else {
+            for (int x = 0; x < width; x++)
+                dst[y * width + x] = pyramid_pack(pyramid_lerp(top[x], bottom[x], wy));
+        }
+    }
+    done = true;
+
+out:
+    free(rows);
+    free(columns);
+    return done;
+}
+
+/*
+ * Like blur_image_surface, but for large sigmas blurs a copy of @surface
+ * downsampled by 2 or 4 instead, and scales the result back up. A Gaussian
+ * that wide has no detail left that the smaller copy would lose, while the
+ * blur touches 4 or 16 times fewer pixels.
+ */
+void blur_image_surface_pyramid(cairo_surface_t *surface, int sigma, int threads, blur_engine_t engine, const blur_effects_t *effects) {
+    int factor = 1;
+    while (factor < 4 && sigma >= 2 * factor * PYRAMID_MIN_SIGMA)
+        factor *= 2;
+
+    if (factor == 1 || cairo_surface_status(surface) ||
+        (cairo_image_surface_get_format(surface) != CAIRO_FORMAT_ARGB32 &&
+         cairo_image_surface_get_format(surface) != CAIRO_FORMAT_RGB24)) {
+        blur_image_surface(surface, sigma, threads, engine, effects);
+        return;
+    }
+
+    const int width = cairo_image_surface_get_width(surface);
+    const int height = cairo_image_surface_get_height(surface);
+    const int small_width = (width + factor - 1) / factor;
+    const int small_height = (height + factor - 1) / factor;
+
+    cairo_surface_t *small = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, small_width, small_height);
+    if (cairo_surface_status(small)) {
+        cairo_surface_destroy(small);
+        blur_image_surface(surface, sigma, threads, engine, effects);
+        return;
+    }
+    DEBUG("blurring at 1/%d resolution (%dx%d)\n", factor, small_width, small_height);
+
+    uint32_t *data = (uint32_t*)cairo_image_surface_get_data(surface);
+    uint32_t *small_data = (uint32_t*)cairo_image_surface_get_data(small);
+
+    cairo_surface_flush(surface);
+    pyramid_downsample(data, width, height, small_data, small_width, small_height, factor);
+    cairo_surface_mark_dirty(small);
+
+    // the effects are applied at full resolution, as the result is scaled up
+    blur_image_surface(small, (sigma + factor / 2) / factor, threads, engine, NULL);
+
+    blur_effects_t prepared;
+    if (!pyramid_upsample(small_data, small_width, small_height, data, width, height, factor,
+                          blur_effects_prepare(effects, &prepared))) {
+        cairo_surface_destroy(small);
+        DEBUG("out of memory scaling the blur back up, blurring at full resolution\n");
+        blur_image_surface(surface, sigma, threads, engine, effects);
+        return;
+    }
+    cairo_surface_destroy(small);
+    cairo_surface_mark_dirty(surface);
+}
+
+/*
+ * Adds the channels of every @block pixels wide block of @row to the four
+ * sums of that block in @sums, in the order of pyramid_expand's lanes.
+ */
+void pixelate_impl_row_sums_generic(const uint32_t *row, int width, int block, uint32_t *sums) {
+    for (int x = 0; x < width; x += block, sums += 4) {
+        const int end = x + block < width ? x + block : width;
+        // at most MAX_PIXELATE_BLOCK pixels of 8 bit each per lane
+        uint64_t acc = 0;
+
+        for (int i = x; i < end; i++)
+            acc += pyramid_expand(row[i]);
+        for (int k = 0; k < 4; k++)
+            sums[k] += acc >> (16 * k) & 0xFFFF;
+    }
+}
+
+/*
+ * Replaces every block of job->block x job->block pixels in the bands
+ * [band_start, band_end) of job->src by its average, with job->effects
+ * applied. Each pixel is read once, while its row is added to the sums of
+ * the blocks of its band, and written once.
+ */
+static void pixelate_bands(blur_job_t *job, int band_start, int band_end) {
+    const blur_effects_t *effects = job->effects;
+    const int width = job->width, block = job->block;
+    const int blocks = (width + block - 1) / block;
+    uint32_t *sums = malloc(4 * blocks * sizeof(uint32_t));
+    uint32_t *colors = malloc(blocks * sizeof(uint32_t));
+    if (!sums || !colors)
+        goto out;
+
+    for (int band = band_start; band < band_end; band++) {
+        const int y0 = band * block;
+        const int y1 = y0 + block < job->height ? y0 + block : job->height;
+
+        memset(sums, 0, 4 * blocks * sizeof(uint32_t));
+        for (int y = y0; y < y1; y++) {
+#ifdef __SSE2__
+            pixelate_impl_row_sums_sse2(job->src + y * width, width, block, sums);
+#else
+            pixelate_impl_row_sums_generic(job->src + y * width, width, block, sums);
+#endif
+        }
+
+        for (int b = 0; b < blocks; b++) {
+            const int columns = (b + 1) * block < width ? block : width - b * block;
+            const uint32_t count = (y1 - y0) * columns;
+            colors[b] = 0;
+            for (int k = 0; k < 4; k++)
+                colors[b] |= (sums[4 * b + k] + count / 2) / count << (8 * k);
+            // without noise, the effects are the same for the whole block
+            if (effects && effects->noise <= 0)
+                colors[b] = blur_apply_effects(effects, colors[b], 0);
+        }
+
+        for (int y = y0; y < y1; y++) {
+            uint32_t *line = job->src + y * width;
+            if (effects && effects->noise > 0) {
+                int grain[TILE_SIZE];
+                for (int x = 0; x < width; x += TILE_SIZE) {
+                    const int count = width - x < TILE_SIZE ? width - x : TILE_SIZE;
+                    blur_effects_grain(effects, y * width + x, grain);
+                    for (int i = 0; i < count; i++)
+                        line[x + i] = blur_apply_effects(effects, colors[(x + i) / block], grain[i]);
+                }
+                continue;
+            }
+            for (int b = 0; b < blocks; b++) {
+                const int end = (b + 1) * block < width ? (b + 1) * block : width;
+                for (int x = b * block; x < end; x++)
+                    line[x] = colors[b];
+            }
+        }
+    }
+
+out:
+    free(colors);
+    free(sums);
+}
+
+/*
+ * Replaces every @block x @block square of @surface by the average of its
+ * pixels, using @threads threads like blur_image_surface, then applies
+ * @effects (which may be NULL). A cheap alternative (or addition) to a blur:
+ * one read and one write of every pixel, no passes and no transposition.
+ */
+void pixelate_image_surface(cairo_surface_t *surface, int block, int threads, const blur_effects_t *effects) {
+    if (cairo_surface_status(surface) ||
+        (cairo_image_surface_get_format(surface) != CAIRO_FORMAT_ARGB32 &&
+         cairo_image_surface_get_format(surface) != CAIRO_FORMAT_RGB24))
+        return;
+    if (block > MAX_PIXELATE_BLOCK)
+        block = MAX_PIXELATE_BLOCK;
+    if (block < 1)
+        block = 1;
+
+    blur_job_t job = {
+        .src = (uint32_t*)cairo_image_surface_get_data(surface),
+        .width = cairo_image_surface_get_width(surface),
+        .height = cairo_image_surface_get_height(surface),
+        .block = block,
+    };
+    blur_effects_t prepared;
+    job.effects = blur_effects_prepare(effects, &prepared);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    cairo_surface_flush(surface);
+    blur_run_threads(&job, threads);
+    cairo_surface_mark_dirty(surface);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    DEBUG("pixelated %dx%d pixels into blocks of %d%s in %.1f ms\n", job.width, job.height, block,
+          job.effects ? ", with effects" : "",
+          (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+}
+
+/*
+ * Writes a tile of @rows x @columns pixels, blurred row by row starting at
+ * (@row, @column), to its transposed location in @dst, applying @effects (if
+ * not NULL) on the way.
+ *
+ * Transposing a single pixel at a time scatters every store by a whole
+ * column of @dst. Going through a tile that stays in L1 turns each column of
+ * the tile into one contiguous run of @rows pixels instead.
+ */
+void blur_store_tile(uint32_t *dst, uint32_t tile[TILE_SIZE][TILE_SIZE], int height,
+                     int row, int column, int rows, int columns, const blur_effects_t *effects) {
+    if (effects) {
+        int grain[TILE_SIZE] = {0};
+        for (int c = 0; c < columns; c++) {
+            const uint32_t index = height * (column + c) + row;
+            if (effects->noise > 0)
+                blur_effects_grain(effects, index, grain);
+            for (int r = 0; r < rows; r++)
+                dst[index + r] = blur_apply_effects(effects, tile[r][c], grain[r]);
+        }
+        return;
+    }
+
+    for (int c = 0; c < columns; c++) {
+        uint32_t *out = dst + height * (column + c) + row;
+        for (int r = 0; r < rows; r++)
+            out[r] = tile[r][c];
+    }
+}
+
+static inline __attribute__((always_inline)) uint32_t blur_impl_pixel_generic(uint32_t *src, uint32_t *end, int column, int width, const int size) {
+    const int half = size / 2;
+    uint32_t rgbaIn[MAX_KERNEL_SIZE];
+
+    // handle borders
+    int leftBorder = column < half;
+    int rightBorder = column >= width - half;
+    int i = 0;
+    if (leftBorder) {
+        // for kernel size 7x7 and column == 0, we have:
+        // x x x P0 P1 P2 P3
+        // first loop mirrors P{0..3} to fill x's,
+        // second one loads P{0..3}
+        for (; i < half - column; i++)
+            rgbaIn[i] = *(src + (half - i));
+        for (; i < size; i++)
+            rgbaIn[i] = *(src - (half - i));
+    } else if (rightBorder) {
+        // and the same at the other end, for column == width - 1:
+        // P-3 P-2 P-1 P0 x x x
+        for (; i < half + width - column; i++)
+            rgbaIn[i] = *(src - (half - i));
+        for (; i < size; i++)
+            rgbaIn[i] = *(src + (half - i));
+    } else {
+        for (; i < size; i++) {
+            // don't read past the end of the image
+            if (src + i - half >= end) {
+                rgbaIn[i] = 0;
+                continue;
+            }
+            rgbaIn[i] = *(src + i - half);
+        }
+    }
+
+    uint32_t acc[4] = {0};
+
+    for (i = 0; i < size; i++) {
+        acc[0] += (rgbaIn[i] & 0xFF000000) >> 24;
+        acc[1] += (rgbaIn[i] & 0x00FF0000) >> 16;
+        acc[2] += (rgbaIn[i] & 0x0000FF00) >> 8;
+        acc[3] += (rgbaIn[i] & 0x000000FF) >> 0;
+    }
+
+    // round to nearest, like the SIMD kernels
+    for(i = 0; i < 4; i++)
+        acc[i] = (acc[i] + size / 2) / size;
+
+    return (acc[0] << 24) |
+           (acc[1] << 16) |
+           (acc[2] << 8 ) |
+           (acc[3] << 0);
+}
+
+static inline __attribute__((always_inline)) void blur_pass_generic(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, const int size) {
+    uint32_t *end = src + height * width;
+    uint32_t tile[TILE_SIZE][TILE_SIZE];
+
+    for (int row = row_start; row < row_end; row += TILE_SIZE) {
+        const int rows = row_end - row < TILE_SIZE ? row_end - row : TILE_SIZE;
+        for (int column = 0; column < width; column += TILE_SIZE) {
+            const int columns = width - column < TILE_SIZE ? width - column : TILE_SIZE;
+            for (int r = 0; r < rows; r++) {
+                uint32_t *line = src + (row + r) * width;
+                for (int c = 0; c < columns; c++)
+                    tile[r][c] = blur_impl_pixel_generic(line + column + c, end, column + c, width, size);
+            }
+            blur_store_tile(dst, tile, height, row, column, rows, columns, effects);
+        }
+    }
+}
+
+void blur_impl_horizontal_pass_generic(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size) {
+    BLUR_SPECIALIZE(blur_pass_generic, size, src, dst, width, height, row_start, row_end, effects);
+}
+
+typedef uint16_t blur_u16x8_t __attribute__((vector_size(16)));
+
+/*
+ * Portable counterpart of blur_impl_4_sse2: blurs 4 neighbouring pixels of a
+ * row whose windows lie within the row. Only uses GCC vector extensions, so
+ * the compiler emits NEON, SSE2, etc. for whatever the target has. The low
+ * and high bytes of every 16 bit lane are summed up separately, which needs
+ * no widening shuffles and works the same on either endianness; the division
+ * by the constant @size becomes a multiplication, with the same results as
+ * the SIMD kernels.
+ */
+static inline __attribute__((always_inline)) void blur_impl_4_vector(uint32_t *src, uint32_t *out, const int size) {
+    blur_u16x8_t lo = {0}, hi = {0};
+
+    for (int k = -(size / 2); k <= size / 2; k++) {
+        blur_u16x8_t in;
+        memcpy(&in, src + k, sizeof(in));
+        lo += in & 0xFF;
+        hi += in >> 8;
+    }
+
+    lo = (lo + (uint16_t)(size / 2)) / (uint16_t)size;
+    hi = (hi + (uint16_t)(size / 2)) / (uint16_t)size;
+
+    blur_u16x8_t result = lo | hi << 8;
+    memcpy(out, &result, sizeof(result));
+}
+
+static inline __attribute__((always_inline)) void blur_pass_vector(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, const int size) {
+    uint32_t *end = src + height * width;
+    uint32_t tile[TILE_SIZE][TILE_SIZE];
+    // last column whose window lies within its row
+    const int limit = width - size / 2 - 1;
+
+    for (int row = row_start; row < row_end; row += TILE_SIZE) {
+        const int rows = row_end - row < TILE_SIZE ? row_end - row : TILE_SIZE;
+        for (int column = 0; column < width; column += TILE_SIZE) {
+            const int columns = width - column < TILE_SIZE ? width - column : TILE_SIZE;
+            for (int r = 0; r < rows; r++) {
+                uint32_t *line = src + (row + r) * width;
+                for (int c = 0; c < columns;) {
+                    const int x = column + c;
+                    if (x >= size / 2 && x + 3 <= limit && c + 4 <= columns) {
+                        blur_impl_4_vector(line + x, &tile[r][c], size);
+                        c += 4;
+                    } else {
+                        tile[r][c] = blur_impl_pixel_generic(line + x, end, x, width, size);
+                        c++;
+                    }
+                }
+            }
+            blur_store_tile(dst, tile, height, row, column, rows, columns, effects);
+        }
+    }
+}
+
+void blur_impl_horizontal_pass_vector(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size) {
+    BLUR_SPECIALIZE(blur_pass_vector, size, src, dst, width, height, row_start, row_end, effects);
+}
+
+/*
+ * Blends @count pixels of @a and @b into @dst, each channel weighted @weight
+ * out of 256 towards @b, rounding to nearest. Used for the --blur-fade
+ * frames, so it has to keep up with the display: with the same byte split as
+ * blur_impl_4_vector, every target gets it vectorized.
+ */
+void blur_interpolate(uint32_t *dst, const uint32_t *a, const uint32_t *b, int count, int weight) {
+    const uint16_t wa = 256 - weight, wb = weight;
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        blur_u16x8_t va, vb;
+        memcpy(&va, a + i, sizeof(va));
+        memcpy(&vb, b + i, sizeof(vb));
+        // 255 * 256 + 128 still fits into a lane
+        blur_u16x8_t lo = ((va & 0xFF) * wa + (vb & 0xFF) * wb + 128) >> 8;
+        blur_u16x8_t hi = ((va >> 8) * wa + (vb >> 8) * wb + 128) >> 8;
+        blur_u16x8_t result = lo | hi << 8;
+        memcpy(dst + i, &result, sizeof(result));
+    }
+
+    for (; i < count; i++) {
+        uint32_t p = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+            p |= (((a[i] >> shift & 0xFF) * wa + (b[i] >> shift & 0xFF) * wb + 128) >> 8) << shift;
+        dst[i] = p;
+    }
+}
+
+/* Mirrors @p back into [0, size), the same way the fixed-size kernels do. */
+static inline int mirror_index(int p, int size) {
+    if (p < 0)
+        return -p;
+    if (p >= size)
+        return 2 * (size - 1) - p;
+    return p;
+}
+
+/*
+ * Box blur of width 2 * @radius + 1 with transposed output, like the fixed-size
+ * passes. Keeps a running sum per channel: each step adds the pixel entering
+ * the window and subtracts the one leaving it, so the cost per pixel does not
+ * depend on @radius.
+ */
+void blur_impl_horizontal_pass_box(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int radius) {
+    if (radius > width - 1)
+        radius = width - 1;
+    const int size = 2 * radius + 1;
+    // fixed-point reciprocal of the box size. The sums stay below 255 * size,
+    // and rounding is exact while size * size < 2^44 / 255; the radius is
+    // clamped to a 16-bit width, so size is below 2^17 and this always holds.
+    const uint64_t scale = ((UINT64_C(1) << 44) + size / 2) / size;
+    uint32_t tile[TILE_SIZE][TILE_SIZE];
+
+    for (int row = row_start; row < row_end; row += TILE_SIZE) {
+        const int rows = row_end - row < TILE_SIZE ? row_end - row : TILE_SIZE;
+        // running sums of every row of the tile, carried across columns
+        uint32_t acc[TILE_SIZE][4] = {{0}};
+
+        for (int r = 0; r < rows; r++) {
+            uint32_t *line = src + (row + r) * width;
+            for (int i = -radius; i <= radius; i++) {
+                uint32_t p = *(line + mirror_index(i, width));
+                acc[r][0] += (p & 0xFF000000) >> 24;
+                acc[r][1] += (p & 0x00FF0000) >> 16;
+                acc[r][2] += (p & 0x0000FF00) >> 8;
+                acc[r][3] += (p & 0x000000FF) >> 0;
+            }
+        }
+
+        for (int column = 0; column < width; column += TILE_SIZE) {
+            const int columns = width - column < TILE_SIZE ? width - column : TILE_SIZE;
+            for (int r = 0; r < rows; r++) {
+                uint32_t *line = src + (row + r) * width;
+                for (int c = column; c < column + columns; c++) {
+                    tile[r][c - column] =
+                        (uint32_t)((acc[r][0] * scale + (UINT64_C(1) << 43)) >> 44) << 24 |
+                        (uint32_t)((acc[r][1] * scale + (UINT64_C(1) << 43)) >> 44) << 16 |
+                        (uint32_t)((acc[r][2] * scale + (UINT64_C(1) << 43)) >> 44) << 8 |
+                        (uint32_t)((acc[r][3] * scale + (UINT64_C(1) << 43)) >> 44) << 0;
+
+                    if (c + 1 == width)
                         break;
-              			rgbaIn[i] = *(src + i - HALF_KERNEL);
-								}
+
+                    // unsigned wrap-around cancels out, acc never goes negative
+                    uint32_t in = *(line + mirror_index(c + radius + 1, width));
+                    uint32_t out = *(line + mirror_index(c - radius, width));
+                    acc[r][0] += ((in & 0xFF000000) >> 24) - ((out & 0xFF000000) >> 24);
+                    acc[r][1] += ((in & 0x00FF0000) >> 16) - ((out & 0x00FF0000) >> 16);
+                    acc[r][2] += ((in & 0x0000FF00) >> 8) - ((out & 0x0000FF00) >> 8);
+                    acc[r][3] += ((in & 0x000000FF) >> 0) - ((out & 0x000000FF) >> 0);
+                }
             }
+            blur_store_tile(dst, tile, height, row, column, rows, columns, effects);
+        }
+    }
+}
+
+typedef float iir_vector_t __attribute__((vector_size(16)));
+typedef int32_t iir_int_vector_t __attribute__((vector_size(16)));
+
+static inline iir_vector_t iir_load(uint32_t p) {
+    iir_int_vector_t v = {p >> 24, p >> 16, p >> 8, p};
+    return __builtin_convertvector(v & 0xFF, iir_vector_t);
+}
+
+static inline uint32_t iir_store(iir_vector_t v) {
+    iir_int_vector_t i = __builtin_convertvector(v + 0.5f, iir_int_vector_t);
+    // the filter can overshoot slightly at sharp edges
+    i &= ~(i < 0);
+    i = (i | ((i > 255) & 0xFF)) & 0xFF;
+    return (uint32_t)i[0] << 24 | (uint32_t)i[1] << 16 | (uint32_t)i[2] << 8 | (uint32_t)i[3];
+}
+
+/*
+ * Recursive Gaussian pass, see blur_iir_coefficients. Each row is filtered
+ * left to right and then right to left, with all four channels of a pixel in
+ * one vector. Every output pixel costs the same few multiply-adds, whatever
+ * the sigma.
+ *
+ * B = 1 - b1 - b2 - b3 gives the filter a gain of 1, but in floats it does
+ * not: for large sigmas B is tiny, and the recursion drifts away from the
+ * input by whole levels even on a flat image. So y = B x + b1 y1 + b2 y2 +
+ * b3 y3 is computed as y = x + b1 (y1 - x) + b2 (y2 - x) + b3 (y3 - x)
+ * instead, which is the same filter, exact on flat areas, and only rounds
+ * the (small) differences elsewhere.
+ *
+ * The recursion makes each pixel depend on the previous one, so IIR_ROWS
+ * rows go through the same loop to give the CPU independent work to overlap.
+ */
+void blur_impl_horizontal_pass_iir(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, const float coefficients[3]) {
+    const float b1 = coefficients[0], b2 = coefficients[1], b3 = coefficients[2];
+    uint32_t tile[TILE_SIZE][TILE_SIZE];
+    iir_vector_t *forward = malloc(IIR_ROWS * width * sizeof(iir_vector_t));
 
-            uint32_t acc[4] = {0};
+    if (!forward) {
+        // a box of radius 0 only transposes, so the image stays intact
+        blur_impl_horizontal_pass_box(src, dst, width, height, row_start, row_end, effects, 0);
+        return;
+    }
 
-            for (i = 0; i < KERNEL_SIZE; i++) {
-                acc[0] += (rgbaIn[i] & 0xFF000000) >> 24;
-                acc[1] += (rgbaIn[i] & 0x00FF0000) >> 16;
-                acc[2] += (rgbaIn[i] & 0x0000FF00) >> 8;
-                acc[3] += (rgbaIn[i] & 0x000000FF) >> 0;
+    for (int row = row_start; row < row_end; row += IIR_ROWS) {
+        const int rows = row_end - row < IIR_ROWS ? row_end - row : IIR_ROWS;
+        uint32_t *lines[IIR_ROWS];
+        iir_vector_t w1[IIR_ROWS], w2[IIR_ROWS], w3[IIR_ROWS];
+
+        // the last block can be short; filtering its last row again keeps
+        // the loops below fixed in length
+        for (int r = 0; r < IIR_ROWS; r++) {
+            lines[r] = src + (row + (r < rows ? r : rows - 1)) * width;
+            // start as if the row was extended with its first pixel
+            w1[r] = w2[r] = w3[r] = iir_load(lines[r][0]);
+        }
+
+        for (int x = 0; x < width; x++) {
+            for (int r = 0; r < IIR_ROWS; r++) {
+                const iir_vector_t in = iir_load(lines[r][x]);
+                iir_vector_t w = in + b1 * (w1[r] - in) + b2 * (w2[r] - in) + b3 * (w3[r] - in);
+                w3[r] = w2[r];
+                w2[r] = w1[r];
+                w1[r] = w;
+                forward[r * width + x] = w;
             }
+        }
 
-            for(i = 0; i < 4; i++)
-                acc[i] *= 1.0/KERNEL_SIZE;
+        for (int r = 0; r < IIR_ROWS; r++)
+            w1[r] = w2[r] = w3[r] = forward[r * width + width - 1];
 
-            *(dst + height * column + row) = (acc[0] << 24) |
-                                             (acc[1] << 16) |
-                                             (acc[2] << 8 ) |
-                                             (acc[3] << 0);
+        for (int column = (width - 1) / TILE_SIZE * TILE_SIZE; column >= 0; column -= TILE_SIZE) {
+            const int columns = width - column < TILE_SIZE ? width - column : TILE_SIZE;
+            for (int c = columns - 1; c >= 0; c--) {
+                for (int r = 0; r < IIR_ROWS; r++) {
+                    const iir_vector_t in = forward[r * width + column + c];
+                    iir_vector_t y = in + b1 * (w1[r] - in) + b2 * (w2[r] - in) + b3 * (w3[r] - in);
+                    w3[r] = w2[r];
+                    w2[r] = w1[r];
+                    w1[r] = y;
+                    tile[r][c] = iir_store(y);
+                }
+            }
+            blur_store_tile(dst, tile, height, row, column, rows, columns, effects);
         }
     }
+
+    free(forward);
 }
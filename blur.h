@@ -1,16 +1,114 @@
 #ifndef _BLUR_H
 #define _BLUR_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <cairo.h>
 
-#define KERNEL_SIZE 7
-#define SIGMA_AV 2
-#define HALF_KERNEL KERNEL_SIZE / 2
+// widest of the fixed-size box kernels, BLUR_SPECIALIZE lists all of them
+#define MAX_KERNEL_SIZE 31
+// 16 bit fixed-point reciprocal of @size: (sum * KERNEL_RECIPROCAL(size)) >> 16
+// equals sum / size for every sum of @size 8 bit channels if
+// KERNEL_RECIPROCAL_EXACT(size), and is at most one too small otherwise
+#define KERNEL_RECIPROCAL(size) ((1 << 16) / (size) + KERNEL_RECIPROCAL_EXACT(size))
+#define KERNEL_RECIPROCAL_EXACT(size) ((size) <= 15)
 
-void blur_image_surface(cairo_surface_t *surface, int sigma);
+/*
+ * Calls @impl, an always inlined function taking the kernel width as its last
+ * argument, with @size as a compile-time constant, so that every width gets
+ * its own fully unrolled copy.
+ */
+#define BLUR_SPECIALIZE(impl, size, ...)        \
+    do {                                         \
+        switch (size) {                          \
+        case 3: impl(__VA_ARGS__, 3); break;     \
+        case 5: impl(__VA_ARGS__, 5); break;     \
+        case 7: impl(__VA_ARGS__, 7); break;     \
+        case 9: impl(__VA_ARGS__, 9); break;     \
+        case 15: impl(__VA_ARGS__, 15); break;   \
+        case 31: impl(__VA_ARGS__, 31); break;   \
+        }                                        \
+    } while (0)
+
+// number of sliding-window passes used for large sigmas
+#define BOX_PASSES 3
+// more passes of the fixed-size kernels are slower than BOX_PASSES
+// sliding-window passes
+#define MAX_KERNEL_PASSES 4
+// relative error in sigma up to which the fixed-size kernels are used
+#define KERNEL_TOLERANCE 0.1
+// blur passes work on TILE_SIZE x TILE_SIZE blocks of pixels, see blur_store_tile
+#define TILE_SIZE 16
+// smallest sigma the pyramid mode blurs with after downsampling
+#define PYRAMID_MIN_SIGMA 4
+
+// AVX2 and AVX-512BW kernels are built into every x86 binary and picked at
+// runtime depending on what the CPU supports
+#if defined(__SSE2__) && defined(__GNUC__)
+#define BLUR_RUNTIME_DISPATCH 1
+#endif
+
+// number of rows the recursive filter runs through at the same time
+#define IIR_ROWS 4
+// widest block pixelate_image_surface averages, which keeps the per-row sums
+// of a block within 16 bit
+#define MAX_PIXELATE_BLOCK 256
+// number of progressively blurred screenshots --blur-fade blends between
+#define BLUR_FADE_LEVELS 4
+
+typedef enum {
+    // stacked fixed-size or sliding-window box filters
+    BLUR_ENGINE_BOX,
+    // recursive Gaussian (Young - van Vliet), cost independent of sigma
+    BLUR_ENGINE_IIR,
+    // convolution on the X server, see xrender_blur_pixmap; blur_image_surface
+    // falls back to BLUR_ENGINE_BOX for it
+    BLUR_ENGINE_XRENDER,
+} blur_engine_t;
+
+/*
+ * Effects applied to every pixel as the last blur pass stores it, so they
+ * need no pass of their own. A zero-initialized struct leaves the blurred
+ * image unchanged.
+ */
+typedef struct {
+    // replace every color by its luma
+    bool grayscale;
+    // blend with the 0xRRGGBB color @tint, weighted @tint_alpha out of 255
+    uint32_t tint;
+    int tint_alpha;
+    // darken by @dim out of 255
+    int dim;
+    // add grain of up to +-@noise to every channel
+    int noise;
+
+    // @tint and @dim for every value of each channel, filled in by
+    // blur_image_surface
+    uint8_t table[3][256];
+} blur_effects_t;
+
+void blur_image_surface(cairo_surface_t *surface, int sigma, int threads, blur_engine_t engine, const blur_effects_t *effects);
+void blur_image_surface_pyramid(cairo_surface_t *surface, int sigma, int threads, blur_engine_t engine, const blur_effects_t *effects);
+bool blur_effects_enabled(const blur_effects_t *effects);
+void pixelate_image_surface(cairo_surface_t *surface, int block, int threads, const blur_effects_t *effects);
+bool blur_set_kernel(const char *name);
+void blur_interpolate(uint32_t *dst, const uint32_t *a, const uint32_t *b, int count, int weight);
+#ifdef __SSE2__
+void blur_impl_horizontal_pass_sse2(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size);
+#endif
+#ifdef BLUR_RUNTIME_DISPATCH
+void blur_impl_horizontal_pass_avx2(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size);
+void blur_impl_horizontal_pass_avx512bw(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size);
+#endif
+void blur_impl_horizontal_pass_vector(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size);
+void blur_impl_horizontal_pass_generic(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size);
+void blur_store_tile(uint32_t *dst, uint32_t tile[TILE_SIZE][TILE_SIZE], int height,
+                     int row, int column, int rows, int columns, const blur_effects_t *effects);
+void blur_impl_horizontal_pass_box(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int radius);
+void pixelate_impl_row_sums_generic(const uint32_t *row, int width, int block, uint32_t *sums);
 #ifdef __SSE2__
-void blur_impl_horizontal_pass_sse2(uint32_t *src, uint32_t *dst, int width, int height);
+void pixelate_impl_row_sums_sse2(const uint32_t *row, int width, int block, uint32_t *sums);
 #endif
-void blur_impl_horizontal_pass_generic(uint32_t *src, uint32_t *dst, int width, int height);
+void blur_iir_coefficients(int sigma, float coefficients[3]);
+void blur_impl_horizontal_pass_iir(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, const float coefficients[3]);
 #endif
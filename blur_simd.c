@@ -8,72 +8,303 @@
  */
 
 
-// number of xmm registers needed to store input pixels for given kernel size
 #ifdef __SSE2__
 #include "blur.h"
-#define REGISTERS_CNT (KERNEL_SIZE + 4/2) / 4
 #include <xmmintrin.h>
-void blur_impl_horizontal_pass_sse2(uint32_t *src, uint32_t *dst, int width, int height) {
-    uint32_t* o_src = src;
-    for (int row = 0; row < height; row++) {
-        for (int column = 0; column < width; column++, src++) {
-            __m128i rgbaIn[REGISTERS_CNT];
-
-            // handle borders
-            int leftBorder = column < HALF_KERNEL;
-            int rightBorder = column > width - HALF_KERNEL;
-            uint32_t _rgbaIn[KERNEL_SIZE + 1] __attribute__((aligned(16)));
-            int i = 0;
-            if (leftBorder) {
-                // for kernel size 7x7 and column == 0, we have:
-                // x x x P0 P1 P2 P3
-                // first loop mirrors P{0..3} to fill x's,
-                // second one loads P{0..3}
-                for (; i < HALF_KERNEL - column; i++)
-                    _rgbaIn[i] = *(src + (HALF_KERNEL - i));
-                for (; i < KERNEL_SIZE; i++)
-                    _rgbaIn[i] = *(src - (HALF_KERNEL - i));
-
-                for (int k = 0; k < REGISTERS_CNT; k++)
-                    rgbaIn[k] = _mm_load_si128((__m128i*)(_rgbaIn + 4*k));
-            } else if (rightBorder) {
-                for (; i < width - column; i++)
-                    _rgbaIn[i] = *(src + i);
-                for (int k = 0; i < KERNEL_SIZE; i++, k++)
-                    _rgbaIn[i] = *(src - k);
-
-                for (int k = 0; k < REGISTERS_CNT; k++)
-                    rgbaIn[k] = _mm_load_si128((__m128i*)(_rgbaIn + 4*k));
-            } else {
-                for (int k = 0; k < REGISTERS_CNT; k++) {
-                    if ((uintptr_t) (((__m128i*) src + 4*k - HALF_KERNEL) + 1)
-                            > (uintptr_t) (o_src + (height * width)))
-                        break;
-                    rgbaIn[k] = _mm_loadu_si128((__m128i*)(src + 4*k - HALF_KERNEL));
+#include <emmintrin.h>
+#ifdef BLUR_RUNTIME_DISPATCH
+#include <immintrin.h>
+#endif
+
+// number of xmm registers needed to store input pixels for given kernel size
+#define REGISTERS_CNT(size) (((size) + 3) / 4)
+
+/*
+ * Divides the 16 bit lanes of @sum, each a sum of @size 8 bit values, by
+ * @size, rounding to nearest. Multiplication is significantly faster than
+ * division, see KERNEL_RECIPROCAL.
+ */
+static inline __attribute__((always_inline)) __m128i blur_divide_sse2(__m128i sum, const int size) {
+    __m128i x = _mm_add_epi16(sum, _mm_set1_epi16(size / 2));
+    __m128i q = _mm_mulhi_epu16(x, _mm_set1_epi16(KERNEL_RECIPROCAL(size)));
+    if (!KERNEL_RECIPROCAL_EXACT(size)) {
+        // q is at most one too small
+        __m128i r = _mm_sub_epi16(x, _mm_mullo_epi16(q, _mm_set1_epi16(size)));
+        q = _mm_sub_epi16(q, _mm_cmpgt_epi16(r, _mm_set1_epi16(size - 1)));
+    }
+    return q;
+}
+
+static inline __attribute__((always_inline)) uint32_t blur_impl_pixel_sse2(uint32_t *src, uint32_t *end, int column, int width, const int size) {
+    const int half = size / 2;
+    __m128i rgbaIn[REGISTERS_CNT(MAX_KERNEL_SIZE)];
+
+    // handle borders
+    int leftBorder = column < half;
+    int rightBorder = column >= width - half;
+    // don't read past the end of the image
+    int pastEnd = src + 4 * REGISTERS_CNT(size) - half > end;
+    uint32_t _rgbaIn[4 * REGISTERS_CNT(MAX_KERNEL_SIZE)] __attribute__((aligned(16)));
+    int i = 0;
+    if (leftBorder || rightBorder || pastEnd) {
+        if (leftBorder) {
+            // for kernel size 7x7 and column == 0, we have:
+            // x x x P0 P1 P2 P3
+            // first loop mirrors P{0..3} to fill x's,
+            // second one loads P{0..3}
+            for (; i < half - column; i++)
+                _rgbaIn[i] = *(src + (half - i));
+            for (; i < size; i++)
+                _rgbaIn[i] = *(src - (half - i));
+        } else if (rightBorder) {
+            // and the same at the other end, for column == width - 1:
+            // P-3 P-2 P-1 P0 x x x
+            for (; i < half + width - column; i++)
+                _rgbaIn[i] = *(src - (half - i));
+            for (; i < size; i++)
+                _rgbaIn[i] = *(src + (half - i));
+        } else {
+            for (; i < size; i++)
+                _rgbaIn[i] = src + i - half < end ? *(src + i - half) : 0;
+        }
+
+        for (int k = 0; k < REGISTERS_CNT(size); k++)
+            rgbaIn[k] = _mm_load_si128((__m128i*)(_rgbaIn + 4*k));
+    } else {
+        for (int k = 0; k < REGISTERS_CNT(size); k++)
+            rgbaIn[k] = _mm_loadu_si128((__m128i*)(src + 4*k - half));
+    }
+
+    // we can only load multiples of 4 pixels, so the pixels past the
+    // kernel in the last register have to be set to zero
+    if (size % 4) {
+        const int last = REGISTERS_CNT(size) - 1;
+        rgbaIn[last] = _mm_and_si128(rgbaIn[last], size % 4 == 1
+            ? _mm_set_epi32(0, 0, 0, 0xFFFFFFFF)
+            : _mm_set_epi32(0, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF));
+    }
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+
+    for (int k = 0; k < REGISTERS_CNT(size); k++) {
+        acc = _mm_add_epi16(acc, _mm_unpacklo_epi8(rgbaIn[k], zero));
+        acc = _mm_add_epi16(acc, _mm_unpackhi_epi8(rgbaIn[k], zero));
+    }
+    acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 8));
+
+    return _mm_cvtsi128_si32(_mm_packus_epi16(blur_divide_sse2(acc, size), zero));
+}
+
+/*
+ * Blurs 4 neighbouring pixels of a row at once, by summing @size unaligned
+ * loads shifted by one pixel each. Gives the same result as
+ * blur_impl_pixel_sse2 for pixels whose window lies within the row.
+ */
+static inline __attribute__((always_inline)) __m128i blur_impl_4_sse2(uint32_t *src, const int size) {
+    __m128i zero = _mm_setzero_si128();
+    // 16 bit per channel, lo holds pixels 0 and 1, hi holds pixels 2 and 3
+    __m128i lo = zero, hi = zero;
+
+    for (int k = -(size / 2); k <= size / 2; k++) {
+        __m128i in = _mm_loadu_si128((__m128i*)(src + k));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(in, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(in, zero));
+    }
+
+    return _mm_packus_epi16(blur_divide_sse2(lo, size), blur_divide_sse2(hi, size));
+}
+
+static inline __attribute__((always_inline)) void blur_pass_sse2(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, const int size) {
+    uint32_t *end = src + height * width;
+    uint32_t tile[TILE_SIZE][TILE_SIZE] __attribute__((aligned(16)));
+    // last column whose window lies within its row
+    const int limit = width - size / 2 - 1;
+
+    for (int row = row_start; row < row_end; row += TILE_SIZE) {
+        const int rows = row_end - row < TILE_SIZE ? row_end - row : TILE_SIZE;
+        for (int column = 0; column < width; column += TILE_SIZE) {
+            const int columns = width - column < TILE_SIZE ? width - column : TILE_SIZE;
+            for (int r = 0; r < rows; r++) {
+                uint32_t *line = src + (row + r) * width;
+                for (int c = 0; c < columns;) {
+                    const int x = column + c;
+                    if (x >= size / 2 && x + 3 <= limit && c + 4 <= columns) {
+                        _mm_storeu_si128((__m128i*)&tile[r][c], blur_impl_4_sse2(line + x, size));
+                        c += 4;
+                    } else {
+                        tile[r][c] = blur_impl_pixel_sse2(line + x, end, x, width, size);
+                        c++;
+                    }
                 }
             }
+            blur_store_tile(dst, tile, height, row, column, rows, columns, effects);
+        }
+    }
+}
 
-            __m128i zero = _mm_setzero_si128();
-            __m128i acc = _mm_setzero_si128();
+void blur_impl_horizontal_pass_sse2(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size) {
+    BLUR_SPECIALIZE(blur_pass_sse2, size, src, dst, width, height, row_start, row_end, effects);
+}
 
-            acc = _mm_add_epi16(acc, _mm_unpacklo_epi8(rgbaIn[0], zero));
-            acc = _mm_add_epi16(acc, _mm_unpackhi_epi8(rgbaIn[0], zero));
-            acc = _mm_add_epi16(acc, _mm_unpacklo_epi8(rgbaIn[1], zero));
+/*
+ * Adds the channels of every @block pixels wide block of @row to the four
+ * sums of that block in @sums. Four pixels at a time are widened to 16 bit
+ * lanes and summed up vertically; only once per block are the lanes of the
+ * even and odd pixels folded together and widened to 32 bit.
+ */
+void pixelate_impl_row_sums_sse2(const uint32_t *row, int width, int block, uint32_t *sums) {
+    __m128i zero = _mm_setzero_si128();
 
-            // kernel size equals to 7, but we can only load multiples of 4 pixels
-            // we have to set 8th pixel to zero
-            acc = _mm_add_epi16(acc, _mm_andnot_si128(_mm_set_epi32(0xFFFFFFFF, 0xFFFFFFFF, 0, 0),
-                                                      _mm_unpackhi_epi8(rgbaIn[1], zero)));
-            acc = _mm_add_epi32(_mm_unpacklo_epi16(acc, zero),
-                                _mm_unpackhi_epi16(acc, zero));
+    for (int x = 0; x < width; x += block, sums += 4) {
+        const int end = x + block < width ? x + block : width;
+        // every lane sums up at most MAX_PIXELATE_BLOCK / 2 channels
+        __m128i acc = zero;
+        int i = x;
 
-            // multiplication is significantly faster than division
-            acc = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(acc),
-                                             _mm_set1_ps(1.0/KERNEL_SIZE)));
+        for (; i + 4 <= end; i += 4) {
+            __m128i in = _mm_loadu_si128((__m128i*)(row + i));
+            acc = _mm_add_epi16(acc, _mm_add_epi16(_mm_unpacklo_epi8(in, zero), _mm_unpackhi_epi8(in, zero)));
+        }
+        acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 8));
 
-            *(dst + height * column + row) =
-                _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(acc, zero), zero));
+        __m128i total = _mm_add_epi32(_mm_loadu_si128((__m128i*)sums), _mm_unpacklo_epi16(acc, zero));
+        for (; i < end; i++)
+            total = _mm_add_epi32(total, _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(row[i]), zero), zero));
+        _mm_storeu_si128((__m128i*)sums, total);
+    }
+}
+
+#ifdef BLUR_RUNTIME_DISPATCH
+/*
+ * The kernels below are compiled for AVX2 and AVX-512BW regardless of the
+ * build flags; blur_image_surface only picks them if the CPU supports them.
+ *
+ * They work like blur_impl_4_sse2 on 8 (AVX2) or 16 (AVX-512BW) pixels,
+ * so the output is bit-exact with the SSE2 kernel. Pixels whose window
+ * would leave the row go through blur_impl_pixel_sse2 itself.
+ */
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) __m256i blur_divide_avx2(__m256i sum, const int size) {
+    __m256i x = _mm256_add_epi16(sum, _mm256_set1_epi16(size / 2));
+    __m256i q = _mm256_mulhi_epu16(x, _mm256_set1_epi16(KERNEL_RECIPROCAL(size)));
+    if (!KERNEL_RECIPROCAL_EXACT(size)) {
+        __m256i r = _mm256_sub_epi16(x, _mm256_mullo_epi16(q, _mm256_set1_epi16(size)));
+        q = _mm256_sub_epi16(q, _mm256_cmpgt_epi16(r, _mm256_set1_epi16(size - 1)));
+    }
+    return q;
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) __m256i blur_impl_8_avx2(uint32_t *src, const int size) {
+    __m256i zero = _mm256_setzero_si256();
+    // unpacking works per 128 bit lane, so lo holds pixels 0, 1, 4, 5 and
+    // hi holds pixels 2, 3, 6, 7; packing puts them back in order
+    __m256i lo = zero, hi = zero;
+
+    for (int k = -(size / 2); k <= size / 2; k++) {
+        __m256i in = _mm256_loadu_si256((__m256i*)(src + k));
+        lo = _mm256_add_epi16(lo, _mm256_unpacklo_epi8(in, zero));
+        hi = _mm256_add_epi16(hi, _mm256_unpackhi_epi8(in, zero));
+    }
+
+    return _mm256_packus_epi16(blur_divide_avx2(lo, size), blur_divide_avx2(hi, size));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __attribute__((always_inline)) __m512i blur_divide_avx512bw(__m512i sum, const int size) {
+    __m512i x = _mm512_add_epi16(sum, _mm512_set1_epi16(size / 2));
+    __m512i q = _mm512_mulhi_epu16(x, _mm512_set1_epi16(KERNEL_RECIPROCAL(size)));
+    if (!KERNEL_RECIPROCAL_EXACT(size)) {
+        __m512i r = _mm512_sub_epi16(x, _mm512_mullo_epi16(q, _mm512_set1_epi16(size)));
+        q = _mm512_mask_add_epi16(q, _mm512_cmpgt_epi16_mask(r, _mm512_set1_epi16(size - 1)),
+                                  q, _mm512_set1_epi16(1));
+    }
+    return q;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __attribute__((always_inline)) __m512i blur_impl_16_avx512bw(uint32_t *src, const int size) {
+    __m512i zero = _mm512_setzero_si512();
+    __m512i lo = zero, hi = zero;
+
+    for (int k = -(size / 2); k <= size / 2; k++) {
+        __m512i in = _mm512_loadu_si512((__m512i*)(src + k));
+        lo = _mm512_add_epi16(lo, _mm512_unpacklo_epi8(in, zero));
+        hi = _mm512_add_epi16(hi, _mm512_unpackhi_epi8(in, zero));
+    }
+
+    return _mm512_packus_epi16(blur_divide_avx512bw(lo, size), blur_divide_avx512bw(hi, size));
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void blur_pass_avx2(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, const int size) {
+    uint32_t *end = src + height * width;
+    uint32_t tile[TILE_SIZE][TILE_SIZE];
+    const int limit = width - size / 2 - 1;
+
+    for (int row = row_start; row < row_end; row += TILE_SIZE) {
+        const int rows = row_end - row < TILE_SIZE ? row_end - row : TILE_SIZE;
+        for (int column = 0; column < width; column += TILE_SIZE) {
+            const int columns = width - column < TILE_SIZE ? width - column : TILE_SIZE;
+            for (int r = 0; r < rows; r++) {
+                uint32_t *line = src + (row + r) * width;
+                for (int c = 0; c < columns;) {
+                    const int x = column + c;
+                    if (x >= size / 2 && x + 7 <= limit && c + 8 <= columns) {
+                        _mm256_storeu_si256((__m256i*)&tile[r][c], blur_impl_8_avx2(line + x, size));
+                        c += 8;
+                    } else {
+                        tile[r][c] = blur_impl_pixel_sse2(line + x, end, x, width, size);
+                        c++;
+                    }
+                }
+            }
+            blur_store_tile(dst, tile, height, row, column, rows, columns, effects);
+        }
+    }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __attribute__((always_inline)) void blur_pass_avx512bw(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, const int size) {
+    uint32_t *end = src + height * width;
+    uint32_t tile[TILE_SIZE][TILE_SIZE];
+    const int limit = width - size / 2 - 1;
+
+    for (int row = row_start; row < row_end; row += TILE_SIZE) {
+        const int rows = row_end - row < TILE_SIZE ? row_end - row : TILE_SIZE;
+        for (int column = 0; column < width; column += TILE_SIZE) {
+            const int columns = width - column < TILE_SIZE ? width - column : TILE_SIZE;
+            for (int r = 0; r < rows; r++) {
+                uint32_t *line = src + (row + r) * width;
+                for (int c = 0; c < columns;) {
+                    const int x = column + c;
+                    if (x >= size / 2 && x + 15 <= limit && c + 16 <= columns) {
+                        _mm512_storeu_si512((__m512i*)&tile[r][c], blur_impl_16_avx512bw(line + x, size));
+                        c += 16;
+                    } else if (x >= size / 2 && x + 7 <= limit && c + 8 <= columns) {
+                        _mm256_storeu_si256((__m256i*)&tile[r][c], blur_impl_8_avx2(line + x, size));
+                        c += 8;
+                    } else {
+                        tile[r][c] = blur_impl_pixel_sse2(line + x, end, x, width, size);
+                        c++;
+                    }
+                }
+            }
+            blur_store_tile(dst, tile, height, row, column, rows, columns, effects);
         }
     }
 }
+
+__attribute__((target("avx2")))
+void blur_impl_horizontal_pass_avx2(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size) {
+    BLUR_SPECIALIZE(blur_pass_avx2, size, src, dst, width, height, row_start, row_end, effects);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void blur_impl_horizontal_pass_avx512bw(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end, const blur_effects_t *effects, int size) {
+    BLUR_SPECIALIZE(blur_pass_avx512bw, size, src, dst, width, height, row_start, row_end, effects);
+}
+#endif
 #endif
@@ -22,6 +22,8 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <xcb/xcb.h>
 #include <xcb/xkb.h>
 #include <xcb/xproto.h>
@@ -205,10 +207,28 @@ char* greeter_text = "";
 bool blur = false;
 bool step_blur = false;
 int blur_sigma = 5;
+/* 0 means one thread per online CPU */
+int blur_threads = 0;
+/* blur a downsampled copy of the screen for large sigmas */
+bool blur_pyramid = false;
+blur_engine_t blur_engine = BLUR_ENGINE_BOX;
+/* average blocks of this many pixels before blurring, if above 1 */
+int pixelate = 0;
+/* dim, tint, grayscale and noise, applied by the last blur pass */
+blur_effects_t blur_effects = {0};
+char blurtintcolor[9] = "00000000";
+/* fade from the screenshot into the blur over this many seconds, if above 0 */
+double blur_fade = 0;
 
 /* do not verify password */
 bool no_verify = false;
 
+/* show frames through the Present extension, paced to the vblank */
+bool present = false;
+
+/* --max-fps, 0 for no limit */
+double max_fps = 0;
+
 uint32_t last_resolution[2];
 xcb_window_t win;
 static xcb_cursor_t cursor;
@@ -225,6 +245,39 @@ bool unlock_indicator = true;
 char *modifier_string = NULL;
 static bool dont_fork = false;
 struct ev_loop *main_loop;
+
+/* screenshots captured by capture_screens(), but not yet blurred */
+static int blur_pending_count = 0;
+static pthread_t blur_thread;
+static bool blur_thread_running = false;
+/* screenshots captured, but not blurred yet, see start_blur */
+static bool blur_pending = false;
+static ev_async blur_done;
+/* --blur-fade: per captured monitor, the screenshot followed by
+ * BLUR_FADE_LEVELS progressively blurred copies of it. blur_fade_thread
+ * blends the frames in between into blur_fade_pixels and puts them into
+ * blur_fade_pixmaps, which render_lock paints through blur_fade_frames.
+ * blur_bg_imgs points to blur_fade_frames from the first frame on, and to
+ * blur_fade_screenshots again once the fade is over. */
+static cairo_surface_t *(*blur_fade_levels)[BLUR_FADE_LEVELS + 1] = NULL;
+static cairo_surface_t **blur_fade_screenshots = NULL;
+static cairo_surface_t **blur_fade_frames = NULL;
+static xcb_pixmap_t *blur_fade_pixmaps = NULL;
+static uint32_t **blur_fade_pixels = NULL;
+/* XCB_NONE where MIT-SHM could not be used */
+static xcb_shm_seg_t *blur_fade_segs = NULL;
+static ev_tstamp blur_fade_start;
+static double blur_fade_period;
+static pthread_t blur_fade_thread;
+static bool blur_fade_running = false;
+static atomic_bool blur_fade_done = false;
+/* a frame is in blur_fade_pixmaps that no background was drawn from yet;
+ * only touched by blur_fade_thread */
+static bool blur_fade_blended = false;
+/* the invalidate_background of the frame that shows it, see
+ * background_shown; 0 until the main loop asked for that frame */
+static atomic_uint blur_fade_serial = 0;
+static ev_async blur_fade_step;
 static struct ev_timer *clear_auth_wrong_timeout;
 static struct ev_timer *clear_indicator_timeout;
 static struct ev_timer *discard_passwd_timeout;
@@ -259,7 +312,10 @@ int gif_img_count = 0;
 
 cairo_surface_t *img = NULL;
 char *img_slideshow[256];
-cairo_surface_t *blur_bg_img = NULL;
+/* blurred screenshots of the monitors, blur_bg_imgs[i] covers blur_bg_rects[i] */
+cairo_surface_t **blur_bg_imgs = NULL;
+Rect *blur_bg_rects = NULL;
+int blur_bg_count = 0;
 int slideshow_image_count = 0;
 int slideshow_interval = 10;
 bool slideshow_random_selection = false;
@@ -292,10 +348,7 @@ char* cmd_power_down = NULL;
 char* cmd_power_off = NULL;
 char* cmd_power_sleep = NULL;
 
-// for the rendering thread, so we can clean it up
-pthread_t draw_thread;
-// main thread still sometimes calls redraw()
-// allow you to disable. handy if you use bar with lots of crap.
+// draw frames on a thread of their own, see start_render_thread
 bool redraw_thread = false;
 
 // experimental bar stuff
@@ -528,7 +581,7 @@ ev_timer *stop_timer(ev_timer *timer_obj) {
 static void finish_input(void) {
     password[input_position] = '\0';
     unlock_state = STATE_KEY_PRESSED;
-    redraw_screen();
+    schedule_redraw(REDRAW_INPUT);
     input_done();
 }
 
@@ -540,7 +593,7 @@ static void finish_input(void) {
 static void clear_auth_wrong(EV_P_ ev_timer *w, int revents) {
     DEBUG("clearing auth wrong\n");
     auth_state = STATE_AUTH_IDLE;
-    redraw_screen();
+    schedule_redraw(REDRAW_AUTH);
 
     /* Clear modifier string. */
     if (modifier_string != NULL) {
@@ -578,7 +631,8 @@ static void input_done(void) {
     STOP_TIMER(clear_auth_wrong_timeout);
     auth_state = STATE_AUTH_VERIFY;
     unlock_state = STATE_STARTED;
-    redraw_screen();
+    /* authenticating blocks the event loop */
+    redraw_now(REDRAW_AUTH);
 
     if (no_verify) {
         ev_break(EV_DEFAULT, EVBREAK_ALL);
@@ -659,7 +713,7 @@ static void input_done(void) {
     failed_attempts += 1;
     clear_input();
     if (unlock_indicator)
-        redraw_screen();
+        schedule_redraw(REDRAW_AUTH);
 
     /* Clear this state after 2 seconds (unless the user enters another
      * password during that time). */
@@ -678,7 +732,7 @@ static void input_done(void) {
 }
 
 static void redraw_timeout(EV_P_ ev_timer *w, int revents) {
-    redraw_screen();
+    schedule_redraw(REDRAW_INPUT);
     STOP_TIMER(w);
 }
 
@@ -942,7 +996,7 @@ static void handle_key_press(xcb_key_press_event_t *event) {
             if (input_position == 0) {
                 START_TIMER(clear_indicator_timeout, 1.0, clear_indicator_cb);
                 unlock_state = STATE_NOTHING_TO_DELETE;
-                redraw_screen();
+                schedule_redraw(REDRAW_INPUT);
                 return;
             }
 
@@ -954,7 +1008,7 @@ static void handle_key_press(xcb_key_press_event_t *event) {
              * empty. */
             START_TIMER(clear_indicator_timeout, 1.0, clear_indicator_cb);
             unlock_state = STATE_BACKSPACE_ACTIVE;
-            redraw_screen();
+            schedule_redraw(REDRAW_INPUT);
             unlock_state = STATE_KEY_PRESSED;
             return;
     }
@@ -983,7 +1037,7 @@ static void handle_key_press(xcb_key_press_event_t *event) {
 
     if (unlock_indicator) {
         unlock_state = STATE_KEY_ACTIVE;
-        redraw_screen();
+        schedule_redraw(REDRAW_INPUT);
         unlock_state = STATE_KEY_PRESSED;
 
         struct ev_timer *timeout = NULL;
@@ -1066,7 +1120,7 @@ static void process_xkb_event(xcb_generic_event_t *gevent) {
                   layout_text = NULL;
             }
             layout_text = get_keylayoutname(keylayout_mode, conn);
-            redraw_screen();
+            schedule_redraw(REDRAW_KEYMAP);
             break;
     }
 }
@@ -1095,14 +1149,16 @@ static void handle_screen_resize(void) {
 
     free(geom);
 
-    redraw_screen();
+    release_render_surfaces();
 
     uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
     xcb_configure_window(conn, win, mask, last_resolution);
     xcb_flush(conn);
 
     randr_query(screen->root);
-    redraw_screen();
+    invalidate_layout();
+    invalidate_background();
+    schedule_redraw(REDRAW_RESIZE);
 }
 
 static ssize_t read_raw_image_native(uint32_t *dest, FILE *src, size_t width, size_t height, int pixstride) {
@@ -1456,6 +1512,460 @@ static enum IMAGE_FORMAT verify_image(const char *image_path) {
  * Callback function for PAM. We only react on password request callbacks.
  *
  */
+/*
+ * Returns true if rectangle b lies completely inside rectangle a.
+ *
+ */
+static bool rect_contains(Rect a, Rect b) {
+    return b.x >= a.x && b.y >= a.y &&
+           b.x + b.width <= a.x + a.width &&
+           b.y + b.height <= a.y + a.height;
+}
+
+/*
+ * Captures every monitor on its own, so that the parts of the root window
+ * which no monitor shows are neither copied nor blurred. Mirrored outputs,
+ * and outputs showing a part of a bigger one, reuse its screenshot.
+ *
+ * The screenshots are stored in blur_bg_imgs, but only become visible to
+ * render_lock once blur_screens() is done and finish_blur() published them.
+ * If @on_server is set, the X server blurs them instead, and they are left
+ * in pixmaps that never cross the X socket.
+ *
+ */
+static void capture_screens(bool on_server) {
+    Rect root = {0, 0, last_resolution[0], last_resolution[1]};
+    int count = (xr_screens > 0 ? xr_screens : 1);
+    blur_bg_imgs = calloc(count, sizeof(cairo_surface_t *));
+    blur_bg_rects = calloc(count, sizeof(Rect));
+    if (blur_bg_imgs == NULL || blur_bg_rects == NULL)
+        err(EXIT_FAILURE, "calloc");
+
+    long pixels = 0;
+    for (int i = 0; i < count; i++) {
+        Rect rect = (xr_screens > 0 ? xr_resolutions[i] : root);
+        if (!rect_contains(root, rect) || rect.width == 0 || rect.height == 0) {
+            DEBUG("monitor %d (%dx%d+%d+%d) lies outside of the root window, blurring all of it\n",
+                  i, rect.width, rect.height, rect.x, rect.y);
+            rect = root;
+        }
+
+        bool covered = false;
+        for (int j = 0; j < count && !covered; j++) {
+            if (j == i)
+                continue;
+            Rect other = (xr_screens > 0 ? xr_resolutions[j] : root);
+            if (!rect_contains(root, other))
+                other = root;
+            /* of two identical rectangles, only the first one is captured */
+            covered = rect_contains(other, rect) && (j < i || !rect_contains(rect, other));
+        }
+        if (covered)
+            continue;
+
+        cairo_surface_t *blur_img;
+        uint32_t *shm_data = (on_server ? NULL : capture_bg_shm(conn, screen, rect.x, rect.y, rect.width, rect.height));
+        if (on_server) {
+            xcb_pixmap_t bg_pixmap = capture_bg_pixmap(conn, screen, rect.x, rect.y, rect.width, rect.height);
+            xrender_blur_pixmap(conn, screen, bg_pixmap, rect.width, rect.height, blur_sigma);
+            /* the pixmap lives as long as the surface, i.e. until we exit */
+            blur_img = cairo_xcb_surface_create(conn, bg_pixmap, get_root_visual_type(screen), rect.width, rect.height);
+        } else if (shm_data != NULL) {
+            /* the X server already wrote the pixels into our memory */
+            static cairo_user_data_key_t shm_key;
+            blur_img = cairo_image_surface_create_for_data((unsigned char *)shm_data, CAIRO_FORMAT_RGB24,
+                                                           rect.width, rect.height, rect.width * 4);
+            cairo_surface_set_user_data(blur_img, &shm_key, shm_data, release_bg_shm);
+        } else {
+            xcb_pixmap_t bg_pixmap = capture_bg_pixmap(conn, screen, rect.x, rect.y, rect.width, rect.height);
+            cairo_surface_t *xcb_img = cairo_xcb_surface_create(conn, bg_pixmap, get_root_visual_type(screen), rect.width, rect.height);
+
+            blur_img = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, rect.width, rect.height);
+            cairo_t *ctx = cairo_create(blur_img);
+
+            cairo_set_source_surface(ctx, xcb_img, 0, 0);
+            cairo_paint(ctx);
+
+            cairo_destroy(ctx);
+            cairo_surface_destroy(xcb_img);
+            xcb_free_pixmap(conn, bg_pixmap);
+        }
+
+        blur_bg_imgs[blur_pending_count] = blur_img;
+        blur_bg_rects[blur_pending_count] = rect;
+        blur_pending_count++;
+        pixels += (long)rect.width * rect.height;
+    }
+
+    DEBUG("captured %d monitor regions, %ld of %ld root window pixels\n",
+          blur_pending_count, pixels, (long)root.width * root.height);
+}
+
+/*
+ * Returns a copy of the image surface @src, in the same format.
+ *
+ */
+static cairo_surface_t *copy_image_surface(cairo_surface_t *src) {
+    int width = cairo_image_surface_get_width(src);
+    int height = cairo_image_surface_get_height(src);
+    cairo_surface_t *copy = cairo_image_surface_create(cairo_image_surface_get_format(src), width, height);
+
+    cairo_surface_flush(src);
+    cairo_surface_flush(copy);
+    for (int y = 0; y < height; y++)
+        memcpy(cairo_image_surface_get_data(copy) + y * cairo_image_surface_get_stride(copy),
+               cairo_image_surface_get_data(src) + y * cairo_image_surface_get_stride(src),
+               width * 4);
+    cairo_surface_mark_dirty(copy);
+    return copy;
+}
+
+static void blur_surface(cairo_surface_t *surface, int sigma, const blur_effects_t *effects) {
+    if (blur_pyramid)
+        blur_image_surface_pyramid(surface, sigma, blur_threads, blur_engine, effects);
+    else
+        blur_image_surface(surface, sigma, blur_threads, blur_engine, effects);
+}
+
+/*
+ * Returns the effects of level @k of --blur-fade: dim, tint and noise ramp up
+ * with the blur. Grayscale cannot be weighted, it is on from level 1 and fades
+ * in with the blend from the screenshot.
+ *
+ */
+static blur_effects_t blur_fade_effects(int k) {
+    blur_effects_t effects = blur_effects;
+    effects.tint_alpha = blur_effects.tint_alpha * k / BLUR_FADE_LEVELS;
+    effects.dim = blur_effects.dim * k / BLUR_FADE_LEVELS;
+    effects.noise = blur_effects.noise * k / BLUR_FADE_LEVELS;
+    return effects;
+}
+
+/*
+ * Blurs the copy of the screenshot in levels[1] so that every level k ends up
+ * blurred with a sigma of k / BLUR_FADE_LEVELS of blur_sigma. The levels in
+ * between only add what is missing on top of the level before: blurs add up
+ * in variance, so that takes small and cheap sigmas. With effects, that goes
+ * on in a copy without them, and every level gets blurred from that with its
+ * share of the effects. The last one is blurred from the screenshot, like
+ * without --blur-fade.
+ *
+ */
+static void blur_fade_chain(cairo_surface_t **levels) {
+    const bool effects = blur_effects_enabled(&blur_effects);
+    cairo_surface_t *chain = levels[1];
+    levels[BLUR_FADE_LEVELS] = copy_image_surface(chain);
+    if (effects)
+        levels[1] = copy_image_surface(chain);
+
+    int variance = 0;
+    for (int k = 1; k < BLUR_FADE_LEVELS; k++) {
+        if (k > 1)
+            levels[k] = copy_image_surface(chain);
+
+        double target = (double)blur_sigma * k / BLUR_FADE_LEVELS;
+        int sigma = lrint(sqrt(fmax(target * target - variance, 0)));
+        /* the effects take a pass */
+        if (effects && sigma == 0)
+            sigma = 1;
+        variance += sigma * sigma;
+        if (effects) {
+            blur_effects_t level_effects = blur_fade_effects(k);
+            blur_surface(levels[k], sigma, &level_effects);
+            if (sigma > 0 && k + 1 < BLUR_FADE_LEVELS)
+                blur_surface(chain, sigma, NULL);
+        } else if (sigma > 0) {
+            blur_surface(levels[k], sigma, NULL);
+            chain = levels[k];
+        }
+    }
+    if (effects)
+        cairo_surface_destroy(chain);
+
+    blur_surface(levels[BLUR_FADE_LEVELS], blur_sigma, &blur_effects);
+}
+
+/*
+ * Pixelates and/or blurs the captured screenshots. Runs on blur_thread while
+ * the lock window is mapped and the input is grabbed, and wakes up the main
+ * loop when done.
+ *
+ */
+static void *blur_screens(void *arg) {
+    for (int i = 0; i < blur_pending_count; i++) {
+        if (blur_fade_levels != NULL) {
+            blur_fade_chain(blur_fade_levels[i]);
+            continue;
+        }
+        /* the effects go with whatever runs last */
+        if (pixelate > 1)
+            pixelate_image_surface(blur_bg_imgs[i], pixelate, blur_threads, blur ? NULL : &blur_effects);
+        if (blur)
+            blur_surface(blur_bg_imgs[i], blur_sigma, &blur_effects);
+    }
+
+    ev_async_send(main_loop, &blur_done);
+    return NULL;
+}
+
+/*
+ * Keeps the unblurred screenshots on screen while blur_screens() builds the
+ * --blur-fade levels from them. Level 1 is copied here, since the worker
+ * must not touch the screenshots render_lock is painting.
+ *
+ */
+static void prepare_blur_fade(void) {
+    blur_fade_levels = calloc(blur_pending_count, sizeof(*blur_fade_levels));
+    if (blur_fade_levels == NULL)
+        err(EXIT_FAILURE, "calloc");
+
+    for (int i = 0; i < blur_pending_count; i++) {
+        blur_fade_levels[i][0] = blur_bg_imgs[i];
+        blur_fade_levels[i][1] = copy_image_surface(blur_bg_imgs[i]);
+    }
+    blur_bg_count = blur_pending_count;
+}
+
+/*
+ * Blends the --blur-fade frames on blur_fade_thread, once per refresh of the
+ * fastest monitor, from the two levels around the time elapsed since the fade
+ * started, and puts them into blur_fade_pixmaps. The position is taken from
+ * the clock, so a frame that comes late skips ahead instead of slowing down
+ * the fade. The next frame is only blended once a background was drawn from
+ * the last one, so a half-updated frame is never shown and frames are
+ * dropped rather than piling up in front of the key presses.
+ *
+ */
+static void *blur_fade_frames_thread(void *arg) {
+    for (;;) {
+        const double now = ev_time();
+        const double t = (now - blur_fade_start) / blur_fade;
+        if (t >= 1) {
+            atomic_store(&blur_fade_done, true);
+            ev_async_send(main_loop, &blur_fade_step);
+            break;
+        }
+
+        if (blur_fade_blended) {
+            const unsigned int serial = atomic_load(&blur_fade_serial);
+            if (serial != 0 && background_shown(serial)) {
+                atomic_store(&blur_fade_serial, 0);
+                blur_fade_blended = false;
+            }
+        }
+
+        if (!blur_fade_blended) {
+            double position = t * BLUR_FADE_LEVELS;
+            int level = (int)position;
+            int weight = lrint((position - level) * 256);
+            for (int i = 0; i < blur_bg_count; i++) {
+                cairo_surface_t *from = blur_fade_levels[i][level];
+                const int width = cairo_image_surface_get_width(from);
+                const int height = cairo_image_surface_get_height(from);
+                /* all levels are copies of each other, with a stride of width * 4 */
+                blur_interpolate(blur_fade_pixels[i],
+                                 (uint32_t *)cairo_image_surface_get_data(from),
+                                 (uint32_t *)cairo_image_surface_get_data(blur_fade_levels[i][level + 1]),
+                                 width * height, weight);
+                put_bg_image(conn, screen, blur_fade_pixmaps[i], width, height,
+                             blur_fade_pixels[i], blur_fade_segs[i]);
+            }
+            blur_fade_blended = true;
+            ev_async_send(main_loop, &blur_fade_step);
+        }
+
+        const double wait = now + blur_fade_period - ev_time();
+        if (wait > 0) {
+            struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Shows the blurred screenshots once the fade is over, and frees what it
+ * took. The render thread is stopped meanwhile, as frames it has not drawn
+ * yet may still paint the surfaces freed here.
+ *
+ */
+static void finish_blur_fade(void) {
+    if (blur_fade_running) {
+        pthread_join(blur_fade_thread, NULL);
+        blur_fade_running = false;
+    }
+    ev_async_stop(main_loop, &blur_fade_step);
+    const bool render_thread_paused = pause_render_thread();
+
+    blur_bg_imgs = blur_fade_screenshots;
+    for (int i = 0; i < blur_bg_count; i++) {
+        blur_bg_imgs[i] = blur_fade_levels[i][BLUR_FADE_LEVELS];
+        for (int k = 0; k < BLUR_FADE_LEVELS; k++)
+            cairo_surface_destroy(blur_fade_levels[i][k]);
+        if (blur_fade_frames != NULL) {
+            cairo_surface_destroy(blur_fade_frames[i]);
+            xcb_free_pixmap(conn, blur_fade_pixmaps[i]);
+            if (blur_fade_segs[i] != XCB_NONE)
+                destroy_bg_shm(conn, blur_fade_segs[i], blur_fade_pixels[i]);
+            else
+                free(blur_fade_pixels[i]);
+        }
+    }
+    free(blur_fade_levels);
+    free(blur_fade_frames);
+    free(blur_fade_pixmaps);
+    free(blur_fade_pixels);
+    free(blur_fade_segs);
+    blur_fade_levels = NULL;
+    blur_fade_frames = NULL;
+    blur_fade_pixmaps = NULL;
+    blur_fade_pixels = NULL;
+    blur_fade_segs = NULL;
+    blur_fade_screenshots = NULL;
+    invalidate_background();
+    schedule_redraw(REDRAW_BACKGROUND);
+    if (render_thread_paused)
+        resume_render_thread();
+}
+
+/*
+ * Shows the frame blur_fade_thread just put into blur_fade_pixmaps. Copying
+ * them into the background is done by the X server. The frame goes to
+ * render_lock through blur_bg_imgs, whose elements are never changed while
+ * a frame may still paint them.
+ *
+ */
+static void blur_fade_step_cb(EV_P_ ev_async *w, int revents) {
+    if (atomic_load(&blur_fade_done)) {
+        finish_blur_fade();
+        return;
+    }
+
+    /* the screenshots stay on screen until the first frame is there */
+    blur_bg_imgs = blur_fade_frames;
+    const unsigned int serial = invalidate_background();
+    redraw_now(REDRAW_BACKGROUND);
+    atomic_store(&blur_fade_serial, serial);
+}
+
+static void start_blur_fade_thread(void) {
+    if (pthread_create(&blur_fade_thread, NULL, blur_fade_frames_thread, NULL) == 0) {
+        blur_fade_running = true;
+    } else {
+        DEBUG("could not start the fade thread, showing the blur right away\n");
+        atomic_store(&blur_fade_done, true);
+        ev_async_send(main_loop, &blur_fade_step);
+    }
+}
+
+/*
+ * Starts fading from the screenshots into the blur, once per refresh of the
+ * fastest monitor. Every frame goes into a pixmap per monitor, through
+ * MIT-SHM if possible.
+ *
+ */
+static void start_blur_fade(void) {
+    ev_async_init(&blur_fade_step, blur_fade_step_cb);
+    ev_async_start(main_loop, &blur_fade_step);
+    atomic_store(&blur_fade_done, false);
+    atomic_store(&blur_fade_serial, 0);
+    blur_fade_blended = false;
+    blur_fade_screenshots = blur_bg_imgs;
+
+    /* the frames are written to the pixmaps as they are */
+    if (!root_format_is_rgb24(conn, screen)) {
+        DEBUG("root window pixel format does not match CAIRO_FORMAT_RGB24, showing the blur right away\n");
+        atomic_store(&blur_fade_done, true);
+        ev_async_send(main_loop, &blur_fade_step);
+        return;
+    }
+
+    blur_fade_frames = calloc(blur_bg_count, sizeof(cairo_surface_t *));
+    blur_fade_pixmaps = calloc(blur_bg_count, sizeof(xcb_pixmap_t));
+    blur_fade_pixels = calloc(blur_bg_count, sizeof(uint32_t *));
+    blur_fade_segs = calloc(blur_bg_count, sizeof(xcb_shm_seg_t));
+    if (blur_fade_frames == NULL || blur_fade_pixmaps == NULL || blur_fade_pixels == NULL || blur_fade_segs == NULL)
+        err(EXIT_FAILURE, "calloc");
+
+    for (int i = 0; i < blur_bg_count; i++) {
+        const int width = cairo_image_surface_get_width(blur_fade_levels[i][0]);
+        const int height = cairo_image_surface_get_height(blur_fade_levels[i][0]);
+        const size_t size = (size_t)width * height * 4;
+
+        blur_fade_pixels[i] = create_bg_shm(conn, size, &blur_fade_segs[i]);
+        if (blur_fade_pixels[i] == NULL) {
+            blur_fade_segs[i] = XCB_NONE;
+            if ((blur_fade_pixels[i] = malloc(size)) == NULL)
+                err(EXIT_FAILURE, "malloc");
+        }
+        blur_fade_pixmaps[i] = xcb_generate_id(conn);
+        xcb_create_pixmap(conn, screen->root_depth, blur_fade_pixmaps[i], screen->root, width, height);
+        blur_fade_frames[i] = cairo_xcb_surface_create(conn, blur_fade_pixmaps[i], get_root_visual_type(screen), width, height);
+    }
+
+    double rate = randr_refresh_rate(screen->root);
+    if (rate <= 0)
+        rate = 60;
+    DEBUG("fading into the blur over %.2f s at %.2f Hz%s\n", blur_fade, rate,
+          blur_fade_segs[0] != XCB_NONE ? ", through MIT-SHM" : "");
+
+    blur_fade_period = 1. / rate;
+    blur_fade_start = ev_time();
+    start_blur_fade_thread();
+}
+
+/*
+ * Waits for blur_thread and shows the blurred screenshots. Called from the
+ * main loop once the blur is done.
+ *
+ */
+static void finish_blur(void) {
+    if (!blur_thread_running)
+        return;
+
+    pthread_join(blur_thread, NULL);
+    blur_thread_running = false;
+    ev_async_stop(main_loop, &blur_done);
+
+    if (blur_fade_levels != NULL) {
+        start_blur_fade();
+        return;
+    }
+    blur_bg_count = blur_pending_count;
+    invalidate_background();
+    schedule_redraw(REDRAW_BACKGROUND);
+}
+
+static void blur_done_cb(EV_P_ ev_async *w, int revents) {
+    finish_blur();
+}
+
+/*
+ * Starts blurring the screenshots capture_screens() took on blur_thread, or
+ * right away if the thread cannot be started. Unless --nofork is given, this
+ * waits for the fork() after the first MapNotify, since the child would not
+ * inherit the thread.
+ *
+ */
+static void start_blur(void) {
+    if (!blur_pending)
+        return;
+    blur_pending = false;
+
+    ev_async_init(&blur_done, blur_done_cb);
+    ev_async_start(main_loop, &blur_done);
+    if (pthread_create(&blur_thread, NULL, blur_screens, NULL) == 0) {
+        blur_thread_running = true;
+    } else {
+        DEBUG("could not start the blur thread, blurring synchronously\n");
+        blur_screens(NULL);
+        ev_async_stop(main_loop, &blur_done);
+        blur_bg_count = blur_pending_count;
+        if (blur_fade_levels != NULL)
+            start_blur_fade();
+    }
+}
+
 static int conv_callback(int num_msg, const struct pam_message **msg,
                          struct pam_response **resp, void *appdata_ptr) {
     if (num_msg == 0)
@@ -1524,6 +2034,7 @@ static void maybe_close_sleep_lock_fd(void) {
  */
 static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
     xcb_generic_event_t *event;
+    bool render_thread_paused;
 
     if (xcb_connection_has_error(conn))
         errx(EXIT_FAILURE, "X11 connection broke, did your server terminate?");
@@ -1557,26 +2068,42 @@ static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
                      * expect to get another MapNotify, but better be sure… */
                     dont_fork = true;
 
+                    /* the child would not inherit the render thread */
+                    render_thread_paused = pause_render_thread();
+
                     /* In the parent process, we exit */
                     if (fork() != 0)
                         exit(EXIT_SUCCESS);
 
                     ev_loop_fork(EV_DEFAULT);
+                    if (render_thread_paused)
+                        resume_render_thread();
+                    start_blur();
                 }
                 break;
 
             case XCB_CONFIGURE_NOTIFY:
+                render_thread_paused = pause_render_thread();
                 handle_screen_resize();
+                if (render_thread_paused)
+                    resume_render_thread();
                 break;
 
             default:
                 if (type == xkb_base_event) {
                     process_xkb_event(event);
                 }
+                if (type == XCB_GE_GENERIC) {
+                    handle_present_event(event);
+                }
                 if (randr_base > -1 &&
                     type == randr_base + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
+                    render_thread_paused = pause_render_thread();
                     randr_query(screen->root);
+                    invalidate_layout();
                     handle_screen_resize();
+                    if (render_thread_paused)
+                        resume_render_thread();
                 }
         }
 
@@ -1735,8 +2262,9 @@ void gif_anim_loop(struct ev_loop *loop, struct ev_timer *timer, int delay) {
 
     if (++img_count >= gif_img_count) img_count = 0;
     img = gif_img[img_count].img;
+    invalidate_background();
     ev_timer_stop(loop, timer);
-    redraw_screen();
+    schedule_redraw(REDRAW_GIF);
     ev_timer_set(timer, gif_img[img_count].delay_sec, 0.);
     ev_timer_start(loop, timer);
 }
@@ -1908,11 +2436,25 @@ int main(int argc, char *argv[]) {
         {"bar-count", required_argument, NULL, 710},
         {"bar-total-width", required_argument, NULL, 711},
 
+        // blur options
+        {"blur-threads", required_argument, NULL, 800},
+        {"blur-pyramid", no_argument, NULL, 801},
+        {"blur-engine", required_argument, NULL, 802},
+        {"blur-dim", required_argument, NULL, 803},
+        {"blur-tint", required_argument, NULL, 804},
+        {"blur-grayscale", no_argument, NULL, 805},
+        {"blur-noise", required_argument, NULL, 806},
+        {"pixelate", required_argument, NULL, 807},
+        {"blur-kernel", required_argument, NULL, 808},
+        {"blur-fade", required_argument, NULL, 809},
+
         // misc.
         {"redraw-thread", no_argument, NULL, 900},
         {"refresh-rate", required_argument, NULL, 901},
         {"composite", no_argument, NULL, 902},
         {"no-verify", no_argument, NULL, 905},
+        {"present", no_argument, NULL, 906},
+        {"max-fps", required_argument, NULL, 907},
 
         // slideshow options
         {"slideshow-interval", required_argument, NULL, 903},
@@ -2570,6 +3112,74 @@ int main(int argc, char *argv[]) {
                 if (sscanf(arg, "%31s", bar_width_expr) != 1) {
                     errx(1, "missing argument for bar-total-width\n");
                 }
+                break;
+
+            // Blur
+            case 800:
+                blur_threads = atoi(optarg);
+                if (blur_threads < 0) {
+                    fprintf(stderr, "blur-threads must be a positive integer; ignoring...\n");
+                    blur_threads = 0;
+                }
+                break;
+            case 801:
+                blur_pyramid = true;
+                break;
+            case 802:
+                if (!strcmp(optarg, "box")) {
+                    blur_engine = BLUR_ENGINE_BOX;
+                } else if (!strcmp(optarg, "iir")) {
+                    blur_engine = BLUR_ENGINE_IIR;
+                } else if (!strcmp(optarg, "xrender")) {
+                    blur_engine = BLUR_ENGINE_XRENDER;
+                } else {
+                    errx(EXIT_FAILURE, "i3lock-color: Invalid blur engine given. Expected one of \"box\", \"iir\" or \"xrender\".");
+                }
+                break;
+            case 803:
+                blur_effects.dim = lrint(strtod(optarg, NULL) * 255);
+                if (blur_effects.dim < 0 || blur_effects.dim > 255) {
+                    fprintf(stderr, "blur-dim must be between 0 and 1; ignoring...\n");
+                    blur_effects.dim = 0;
+                }
+                break;
+            case 804:
+                parse_color(blurtintcolor);
+                /* the alpha of the color is how much of it is blended in */
+                blur_effects.tint = strtoul(blurtintcolor, NULL, 16) >> 8;
+                blur_effects.tint_alpha = strtoul(blurtintcolor, NULL, 16) & 0xFF;
+                /* parse_color makes rrggbb opaque, which would hide the
+                 * screenshot behind the color */
+                if (strlen(optarg) - (optarg[0] == '#') == 6)
+                    blur_effects.tint_alpha = 0x40;
+                break;
+            case 805:
+                blur_effects.grayscale = true;
+                break;
+            case 806:
+                blur_effects.noise = atoi(optarg);
+                if (blur_effects.noise < 0 || blur_effects.noise > 255) {
+                    fprintf(stderr, "blur-noise must be between 0 and 255; ignoring...\n");
+                    blur_effects.noise = 0;
+                }
+                break;
+            case 807:
+                pixelate = atoi(optarg);
+                if (pixelate < 0 || pixelate > MAX_PIXELATE_BLOCK) {
+                    fprintf(stderr, "pixelate must be between 0 and %d; ignoring...\n", MAX_PIXELATE_BLOCK);
+                    pixelate = 0;
+                }
+                break;
+            case 808:
+                if (!blur_set_kernel(optarg))
+                    errx(EXIT_FAILURE, "i3lock-color: Invalid blur kernel given. Expected one of \"avx512bw\", \"avx2\", \"sse2\", \"vector\" or \"generic\", supported by this build and CPU.");
+                break;
+            case 809:
+                blur_fade = strtod(optarg, NULL);
+                if (blur_fade < 0) {
+                    fprintf(stderr, "blur-fade must be a positive number of seconds; ignoring...\n");
+                    blur_fade = 0;
+                }
                 break;
 
 			// Misc
@@ -2600,6 +3210,16 @@ int main(int argc, char *argv[]) {
             case 905:
                 no_verify = true;
                 break;
+            case 906:
+                present = true;
+                break;
+            case 907:
+                max_fps = strtod(optarg, NULL);
+                if (max_fps < 0) {
+                    fprintf(stderr, "max-fps must be a positive number; ignoring...\n");
+                    max_fps = 0;
+                }
+                break;
             case 998:
                 image_raw_format = strdup(optarg);
                 break;
@@ -2740,20 +3360,32 @@ int main(int argc, char *argv[]) {
     }
     free(image_raw_format);
 
-    if (blur) {
-        xcb_pixmap_t bg_pixmap = capture_bg_pixmap(conn, screen, last_resolution);
-        cairo_surface_t *xcb_img = cairo_xcb_surface_create(conn, bg_pixmap, get_root_visual_type(screen), last_resolution[0], last_resolution[1]);
-
-        blur_bg_img = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, last_resolution[0], last_resolution[1]);
-        cairo_t *ctx = cairo_create(blur_bg_img);
-
-        cairo_set_source_surface(ctx, xcb_img, 0, 0);
-        cairo_paint(ctx);
-        blur_image_surface(blur_bg_img, blur_sigma);
+    /* Initialize the libev event loop. */
+    main_loop = EV_DEFAULT;
+    if (main_loop == NULL)
+        errx(EXIT_FAILURE, "Could not initialize libev. Bad LIBEV_FLAGS?");
 
-        cairo_destroy(ctx);
-        cairo_surface_destroy(xcb_img);
-        xcb_free_pixmap(conn, bg_pixmap);
+    /* Take the screenshots now, but blur them while the lock window is mapped
+     * and the input grabbed, which then starts out in the background color. */
+    /* Pixelation and the effects need the pixels in our memory. */
+    if (blur && blur_engine == BLUR_ENGINE_XRENDER && pixelate <= 1 && !blur_effects_enabled(&blur_effects) &&
+        blur_fade <= 0 && !redraw_thread && xrender_blur_available(conn, screen)) {
+        capture_screens(true);
+        blur_bg_count = blur_pending_count;
+    } else if (blur || pixelate > 1) {
+        if (blur_engine == BLUR_ENGINE_XRENDER)
+            DEBUG("cannot blur on the X server, blurring with the box engine\n");
+        capture_screens(false);
+        if (blur_fade > 0 && blur && pixelate <= 1 && !redraw_thread)
+            prepare_blur_fade();
+        else if (blur_fade > 0 && redraw_thread)
+            DEBUG("cannot fade with --redraw-thread, showing the blur right away\n");
+        else if (blur_fade > 0)
+            DEBUG("cannot fade into --pixelate, showing it right away\n");
+
+        blur_pending = true;
+        if (dont_fork)
+            start_blur();
     }
 
     xcb_window_t stolen_focus = find_focused_window(conn, screen->root);
@@ -2761,10 +3393,8 @@ int main(int argc, char *argv[]) {
     /* Open the fullscreen window, already with the correct pixmap in place */
     win = open_fullscreen_window(conn, screen, color);
 
-    xcb_pixmap_t pixmap = create_bg_pixmap(conn, win, last_resolution, color);
-    render_lock(last_resolution, pixmap);
-    xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[]){pixmap});
-    xcb_free_pixmap(conn, pixmap);
+    start_present();
+    redraw_now(REDRAW_BACKGROUND);
 
     cursor = create_cursor(conn, screen, win, curs_choice);
 
@@ -2782,7 +3412,7 @@ int main(int argc, char *argv[]) {
         xcb_set_input_focus(conn, XCB_INPUT_FOCUS_PARENT /* revert_to */, win, XCB_CURRENT_TIME);
         if (!grab_pointer_and_keyboard(conn, screen, cursor, 9000)) {
             auth_state = STATE_I3LOCK_LOCK_FAILED;
-            redraw_screen();
+            redraw_now(REDRAW_AUTH);
             sleep(1);
             errx(EXIT_FAILURE, "Cannot grab pointer/keyboard");
         }
@@ -2806,14 +3436,9 @@ int main(int argc, char *argv[]) {
      * keyboard. */
     (void)load_keymap();
 
-    /* Initialize the libev event loop. */
-    main_loop = EV_DEFAULT;
-    if (main_loop == NULL)
-        errx(EXIT_FAILURE, "Could not initialize libev. Bad LIBEV_FLAGS?");
-
     /* Explicitly call the screen redraw in case "locking…" message was displayed */
     auth_state = STATE_AUTH_IDLE;
-    redraw_screen();
+    schedule_redraw(REDRAW_AUTH);
 
     struct ev_io *xcb_watcher = calloc(sizeof(struct ev_io), 1);
     struct ev_check *xcb_check = calloc(sizeof(struct ev_check), 1);
@@ -2829,6 +3454,8 @@ int main(int argc, char *argv[]) {
     ev_prepare_init(xcb_prepare, xcb_prepare_cb);
     ev_prepare_start(main_loop, xcb_prepare);
 
+    start_frame_scheduler(main_loop);
+
     if (gif_img) {
         ev_timer_init(xcb_timer, gif_anim_loop, gif_img[0].delay_sec, 0.);
         ev_timer_start(main_loop, xcb_timer);
@@ -2839,19 +3466,14 @@ int main(int argc, char *argv[]) {
      * file descriptor becomes readable). */
     ev_invoke(main_loop, xcb_check, 0);
 
-    if (show_clock || bar_enabled || slideshow_enabled) {
-        if (redraw_thread) {
-            struct timespec ts;
-            double s;
-            double ns = modf(refresh_rate, &s);
-            ts.tv_sec = (time_t) s;
-            ts.tv_nsec = ns * NANOSECONDS_IN_SECOND;
-            (void) pthread_create(&draw_thread, NULL, start_time_redraw_tick_pthread, (void*) &ts);
-        } else {
-            start_time_redraw_tick(main_loop);
-        }
+    if (redraw_thread) {
+        start_render_thread(show_clock || bar_enabled || slideshow_enabled);
+    } else if (show_clock || bar_enabled || slideshow_enabled) {
+        start_time_redraw_tick(main_loop);
     }
     ev_loop(main_loop, 0);
+    pause_render_thread();
+    print_redraw_stats();
 
 #ifndef __OpenBSD__
     if (pam_cleanup) {
@@ -285,6 +285,62 @@ void _xinerama_query_screens(void) {
     free(reply);
 }
 
+/*
+ * Returns the highest refresh rate (in Hz) of the active CRTCs, or 0 if RandR
+ * is not available or does not know it.
+ *
+ */
+double randr_refresh_rate(xcb_window_t root) {
+    if (!has_randr) {
+        return 0;
+    }
+
+    xcb_randr_get_screen_resources_current_reply_t *res =
+        xcb_randr_get_screen_resources_current_reply(conn, xcb_randr_get_screen_resources_current(conn, root), NULL);
+    if (res == NULL) {
+        DEBUG("Could not query screen resources.\n");
+        return 0;
+    }
+
+    const int crtc_count = xcb_randr_get_screen_resources_current_crtcs_length(res);
+    xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_current_crtcs(res);
+    const int mode_count = xcb_randr_get_screen_resources_current_modes_length(res);
+    xcb_randr_mode_info_t *modes = xcb_randr_get_screen_resources_current_modes(res);
+
+    xcb_randr_get_crtc_info_cookie_t cookies[crtc_count];
+    for (int i = 0; i < crtc_count; i++) {
+        cookies[i] = xcb_randr_get_crtc_info(conn, crtcs[i], res->config_timestamp);
+    }
+
+    double rate = 0;
+    for (int i = 0; i < crtc_count; i++) {
+        xcb_randr_get_crtc_info_reply_t *crtc = xcb_randr_get_crtc_info_reply(conn, cookies[i], NULL);
+        if (crtc == NULL) {
+            continue;
+        }
+        for (int j = 0; j < mode_count; j++) {
+            if (crtc->mode == XCB_NONE || modes[j].id != crtc->mode ||
+                modes[j].htotal == 0 || modes[j].vtotal == 0) {
+                continue;
+            }
+            /* same as xrandr(1) */
+            double vtotal = modes[j].vtotal;
+            if (modes[j].mode_flags & XCB_RANDR_MODE_FLAG_DOUBLE_SCAN)
+                vtotal *= 2;
+            if (modes[j].mode_flags & XCB_RANDR_MODE_FLAG_INTERLACE)
+                vtotal /= 2;
+            double crtc_rate = modes[j].dot_clock / (modes[j].htotal * vtotal);
+            if (crtc_rate > rate)
+                rate = crtc_rate;
+        }
+        free(crtc);
+    }
+    free(res);
+
+    DEBUG("refresh rate is %.2f Hz\n", rate);
+    return rate;
+}
+
 void randr_query(xcb_window_t root) {
     if (_randr_query_monitors_15(root)) {
         return;
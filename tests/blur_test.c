@@ -0,0 +1,141 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Checks the arithmetic the blur kernels rely on, exhaustively where the
+ * inputs allow it. Exits with a non-zero status if anything is off.
+ *
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "blur.h"
+
+/* blur.c prints through DEBUG, which i3lock.c otherwise provides this for */
+bool debug_mode = false;
+
+static int failures = 0;
+
+/*
+ * The fixed-size SIMD kernels divide the 16 bit sum of @size 8 bit channels
+ * by @size like blur_divide_sse2 does: add size / 2, multiply by
+ * KERNEL_RECIPROCAL, and correct the quotient by one unless
+ * KERNEL_RECIPROCAL_EXACT. That must round like the generic kernel, for
+ * every sum.
+ *
+ */
+static void check_kernel_reciprocal(int size) {
+    for (int sum = 0; sum <= 255 * size; sum++) {
+        const uint16_t x = sum + size / 2;
+        const uint16_t want = x / size;
+        uint16_t q = (uint32_t)x * (uint16_t)KERNEL_RECIPROCAL(size) >> 16;
+
+        if (q != want && (KERNEL_RECIPROCAL_EXACT(size) || q + 1 != want)) {
+            fprintf(stderr, "KERNEL_RECIPROCAL(%d): %d / %d is %d, not %d before the correction\n",
+                    size, x, size, q, want);
+            failures++;
+            return;
+        }
+        if (!KERNEL_RECIPROCAL_EXACT(size)) {
+            const uint16_t r = x - (uint16_t)(q * size);
+            q += (int16_t)r > size - 1;
+        }
+        if (q != want) {
+            fprintf(stderr, "KERNEL_RECIPROCAL(%d): %d / %d is %d, not %d\n", size, x, size, q, want);
+            failures++;
+            return;
+        }
+    }
+}
+
+/*
+ * A flat image must come out of the recursive filter unchanged, in every
+ * channel and for every sigma --blur accepts in practice: its gain is 1.
+ *
+ */
+static void check_iir_flat(int sigma) {
+    enum { width = 512, height = IIR_ROWS };
+    static uint32_t src[width * height], dst[width * height];
+    float coefficients[3];
+    blur_iir_coefficients(sigma, coefficients);
+
+    for (int value = 0; value < 256; value++) {
+        const uint32_t pixel = value * 0x01010101u;
+        for (int i = 0; i < width * height; i++)
+            src[i] = pixel;
+        blur_impl_horizontal_pass_iir(src, dst, width, height, 0, height, NULL, coefficients);
+        for (int i = 0; i < width * height; i++) {
+            if (dst[i] != pixel) {
+                fprintf(stderr, "iir, sigma %d: flat 0x%08x became 0x%08x\n", sigma, pixel, dst[i]);
+                failures++;
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * The fixed-size box kernels must only ever read from the row they blur. Rows
+ * that are flat, but each different from the next, have to stay the same all
+ * the way to both edges.
+ *
+ */
+typedef void (*box_pass_t)(uint32_t *src, uint32_t *dst, int width, int height, int row_start, int row_end,
+                           const blur_effects_t *effects, int size);
+
+static void check_box_rows(const char *name, box_pass_t pass, int size) {
+    /* wider than any kernel, and not a multiple of TILE_SIZE */
+    enum { width = 45, height = 5 };
+    static uint32_t src[width * height], dst[width * height];
+
+    for (int row = 0; row < height; row++)
+        for (int column = 0; column < width; column++)
+            src[row * width + column] = row % 2 ? 0xffffffffu : 0;
+    pass(src, dst, width, height, 0, height, NULL, size);
+
+    for (int column = 0; column < width; column++) {
+        for (int row = 0; row < height; row++) {
+            const uint32_t want = src[row * width];
+            if (dst[column * height + row] != want) {
+                fprintf(stderr, "%s, width %d: row %d, column %d is 0x%08x, not 0x%08x\n",
+                        name, size, row, column, dst[column * height + row], want);
+                failures++;
+                return;
+            }
+        }
+    }
+}
+
+int main(void) {
+    /* every width BLUR_SPECIALIZE may be called with, and the ones between */
+    for (int size = 3; size <= MAX_KERNEL_SIZE; size += 2)
+        check_kernel_reciprocal(size);
+    for (int sigma = 1; sigma <= 200; sigma++)
+        check_iir_flat(sigma);
+    /* the widths BLUR_SPECIALIZE instantiates */
+    static const int sizes[] = {3, 5, 7, 9, 15, 31};
+#ifdef BLUR_RUNTIME_DISPATCH
+    __builtin_cpu_init();
+#endif
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        const int size = sizes[i];
+        check_box_rows("generic", blur_impl_horizontal_pass_generic, size);
+        check_box_rows("vector", blur_impl_horizontal_pass_vector, size);
+#ifdef __SSE2__
+        check_box_rows("sse2", blur_impl_horizontal_pass_sse2, size);
+#endif
+#ifdef BLUR_RUNTIME_DISPATCH
+        if (__builtin_cpu_supports("avx2"))
+            check_box_rows("avx2", blur_impl_horizontal_pass_avx2, size);
+        if (__builtin_cpu_supports("avx512bw"))
+            check_box_rows("avx512bw", blur_impl_horizontal_pass_avx512bw, size);
+#endif
+    }
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
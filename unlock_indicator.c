@@ -13,8 +13,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <xcb/xcb.h>
 #include <xcb/randr.h>
+#include <xcb/present.h>
+#include <xcb/xcb_aux.h>
 #include <ev.h>
 #include <cairo.h>
 #include <cairo/cairo-xcb.h>
@@ -38,12 +44,25 @@ extern double ring_width;
 #define BUTTON_SPACE (BUTTON_RADIUS + (RING_WIDTH / 2))
 #define BUTTON_DIAMETER (2 * BUTTON_SPACE)
 
+/* How many pixmaps redraw_screen rotates through. */
+#define SCREEN_BUFFERS 2
+
+/* How many seconds the X server may take to show a frame with --present
+ * before the window background is updated directly instead. */
+#define PRESENT_TIMEOUT 0.5
+
 /*******************************************************************************
  * Variables defined in i3lock.c.
  ******************************************************************************/
 
 extern bool debug_mode;
 
+/* Whether frames should be shown through the Present extension. */
+extern bool present;
+
+/* The most frames per second to draw, 0 for no limit. */
+extern double max_fps;
+
 /* The current position in the input buffer. Useful to determine if any
  * characters of the password have already been entered or not. */
 extern int input_position;
@@ -65,7 +84,9 @@ extern cairo_surface_t *img;
 extern char *image_path;
 extern char *slideshow_path;
 extern char *img_slideshow[256];
-extern cairo_surface_t *blur_bg_img;
+extern cairo_surface_t **blur_bg_imgs;
+extern Rect *blur_bg_rects;
+extern int blur_bg_count;
 extern int slideshow_image_count;
 extern int slideshow_interval;
 extern bool slideshow_random_selection;
@@ -186,9 +207,109 @@ extern xcb_screen_t *screen;
 /* time stuff */
 static struct ev_periodic *time_redraw_tick;
 
+/* The connection frames are drawn with: conn, or the render thread's own. */
+static xcb_connection_t *render_conn;
+
+/* The frame being drawn. render_lock takes everything that changes while the
+ * screen is locked from here instead of the main loop's state. */
+static frame_t frame;
+
 /* Cache the screen’s visual, necessary for creating a Cairo context. */
 static xcb_visualtype_t *vistype;
 
+/* The surfaces render_lock draws into and their contexts, kept across
+ * redraws. They are sized to the resolution they were created for, see
+ * release_render_surfaces. */
+static cairo_surface_t *render_output;
+static cairo_t *render_ctx;
+static cairo_surface_t *render_xcb_output;
+static cairo_t *render_xcb_ctx;
+
+/* The background as of the last redraw, in a pixmap of its own, so that
+ * scaling the image and painting the screenshots is not done again for every
+ * key press. Rebuilt by render_lock after invalidate_background. */
+static xcb_pixmap_t bg_cache_pixmap;
+static cairo_surface_t *bg_cache;
+/* set by invalidate_background, passed on with the next frame */
+static bool background_stale = false;
+/* counts invalidate_background, and the count redraw_screen last drew */
+static unsigned int background_serial = 0;
+static atomic_uint background_drawn = 0;
+
+/* The current slideshow image, once render_lock has loaded one. */
+static cairo_surface_t *slideshow_img;
+
+/* The pixmaps redraw_screen takes turns drawing on and showing as the window
+ * background, so that it never draws on the one that is shown. */
+static xcb_pixmap_t screen_pixmaps[SCREEN_BUFFERS];
+static int screen_pixmap_next = 0;
+
+/* With --present, the major opcode of the extension, see start_present.
+ * A frame is only drawn once the last one has been shown and the X server
+ * no longer uses the pixmap it goes to. Until then, redraws wait in the
+ * frame scheduler, except for redraw_now. */
+static uint8_t present_opcode = 0;
+static uint32_t present_serial = 0;
+static uint64_t present_msc = 0;
+static bool present_pending = false;
+static double present_sent = 0;
+static bool screen_pixmap_busy[SCREEN_BUFFERS];
+/* the window shows an older frame than the pixmaps, see give_up_present */
+static bool screen_behind = false;
+
+/* Redraws asked for with schedule_redraw and not drawn yet, as a mask of
+ * redraw_reason_t, drawn by frame_prepare_cb at most once per iteration of
+ * the event loop. */
+static struct ev_loop *frame_loop;
+static ev_prepare frame_prepare;
+static ev_timer frame_delay;
+static uint32_t redraw_reasons = 0;
+static double last_frame = 0;
+/* A key press highlights the indicator only in the frame drawn for it, so
+ * that state is kept until the frame is drawn. */
+static unlock_state_t highlight_state = STATE_STARTED;
+
+/* Per reason, how often a redraw was asked for and how many frames it was
+ * one of the reasons for. */
+static unsigned int redraw_requests[REDRAW_REASONS];
+static unsigned int redraw_frames[REDRAW_REASONS];
+static unsigned int frames_drawn = 0;
+
+/* With --redraw-thread, frames are drawn by render_thread on a connection of
+ * its own. The main loop hands it copies of the frames in a ring, which only
+ * the main loop writes to and only the render thread reads from, and then
+ * posts frame_posted. */
+#define FRAME_QUEUE_SIZE 8
+static frame_t frame_queue[FRAME_QUEUE_SIZE];
+static atomic_uint frame_queue_head = 0;
+static atomic_uint frame_queue_tail = 0;
+static atomic_bool frame_queue_full = false;
+static atomic_bool render_thread_stop = false;
+static sem_t frame_posted;
+static pthread_t render_thread_id;
+static bool render_thread_running = false;
+static bool render_thread_tick = false;
+/* wakes up the main loop when the ring has room again */
+static ev_async frame_queue_drained;
+
+/* The drawables render_lock has drawn on, with what changed on screen since
+ * it last drew on each. Their content is only updated there. A NULL region
+ * means all of it changed. */
+typedef struct {
+    xcb_drawable_t drawable;
+    cairo_region_t *stale;
+} render_target_t;
+
+static render_target_t render_targets[SCREEN_BUFFERS];
+static int render_target_next = 0;
+static xcb_drawable_t render_drawable = XCB_NONE;
+
+/* Where the overlay was drawn this frame and the last one, in pixels, and
+ * the union of both that render_lock updated on the drawable. */
+static cairo_region_t *frame_ink;
+static cairo_region_t *last_ink;
+static cairo_region_t *render_damage;
+
 int current_slideshow_index = 0;
 
 /* Maintain the current unlock/PAM state to draw the appropriate unlock
@@ -322,6 +443,25 @@ static cairo_font_face_t *get_font_face(int which) {
     return face;
 }
 
+/*
+ * Adds what stroking the current path would cover to frame_ink. Filling
+ * covers no more than that. One pixel is added around it for antialiasing.
+ *
+ */
+static void add_ink(cairo_t *ctx) {
+    double x1, y1, x2, y2;
+    cairo_stroke_extents(ctx, &x1, &y1, &x2, &y2);
+    /* the overlay is only ever scaled, so the corners stay corners */
+    cairo_user_to_device(ctx, &x1, &y1);
+    cairo_user_to_device(ctx, &x2, &y2);
+    cairo_rectangle_int_t area = {
+        floor(x1) - 1,
+        floor(y1) - 1,
+        ceil(x2) - floor(x1) + 2,
+        ceil(y2) - floor(y1) + 2};
+    cairo_region_union_rectangle(frame_ink, &area);
+}
+
 /*
  * Splits the given text by "control chars",
  * And then draws the given text onto the cairo context.
@@ -444,6 +584,7 @@ static void draw_text(cairo_t *ctx, text_t text) {
 
     cairo_set_source_rgba(ctx, text.outline_color.red, text.outline_color.green, text.outline_color.blue, text.outline_color.alpha);
     cairo_set_line_width(ctx, text.outline_width);
+    add_ink(ctx);
     cairo_stroke(ctx);
 }
 
@@ -458,6 +599,7 @@ static void draw_single_bar(cairo_t *ctx, double pos, double offset, double widt
         cairo_rectangle(ctx, offset, pos, height, width);
     else
         cairo_rectangle(ctx, pos, offset, width, height);
+    add_ink(ctx);
     cairo_fill(ctx);
 }
 
@@ -465,7 +607,7 @@ static void draw_bar(cairo_t *ctx, double bar_x, double bar_y, double bar_width,
 
     cairo_save(ctx);
 
-    switch (auth_state) {
+    switch (frame.auth_state) {
         case STATE_AUTH_VERIFY:
         case STATE_AUTH_LOCK:
             cairo_set_source_rgba(ctx, ringver16.red, ringver16.green, ringver16.blue, ringver16.alpha);
@@ -484,7 +626,7 @@ static void draw_bar(cairo_t *ctx, double bar_x, double bar_y, double bar_width,
     else
         draw_single_bar(ctx, bar_x, bar_y, bar_width, bar_base_height);
 
-    if (unlock_state == STATE_BACKSPACE_ACTIVE)
+    if (frame.unlock_state == STATE_BACKSPACE_ACTIVE)
         cairo_set_source_rgba(ctx, bshl16.red, bshl16.green, bshl16.blue, bshl16.alpha);
     else
         cairo_set_source_rgba(ctx, keyhl16.red, keyhl16.green, keyhl16.blue, keyhl16.alpha);
@@ -509,25 +651,63 @@ static void draw_bar(cairo_t *ctx, double bar_x, double bar_y, double bar_width,
         }
     }
 
+    cairo_restore(ctx);
+}
+
+/*
+ * Raises the bars around a random one for a key press, before a frame is
+ * drawn. Done once per frame, not per monitor, so that all monitors show the
+ * same bars.
+ *
+ */
+static void raise_bar_heights(void) {
+    if (frame.unlock_state != STATE_KEY_ACTIVE &&
+        frame.unlock_state != STATE_BACKSPACE_ACTIVE)
+        return;
+
+    // note: might be biased to cause more hits on lower indices
+    // maybe see about doing ((double) rand() / RAND_MAX) * bar_count
+    int index = rand() % bar_count;
+    bar_heights[index] = max_bar_height;
+    for (int i = 0; i < ((max_bar_height / bar_step) + 1); ++i) {
+        int low_ind = index - i;
+        while (low_ind < 0) {
+            low_ind += bar_count;
+        }
+        int high_ind = (index + i) % bar_count;
+        int tmp_height = max_bar_height - (bar_step * i);
+        if (tmp_height < 0)
+            tmp_height = 0;
+        if (bar_heights[low_ind] < tmp_height)
+            bar_heights[low_ind] = tmp_height;
+        if (bar_heights[high_ind] < tmp_height)
+            bar_heights[high_ind] = tmp_height;
+        if (tmp_height == 0)
+            break;
+    }
+}
+
+/* Lowers the bars after a frame was drawn. */
+static void lower_bar_heights(void) {
     for (int i = 0; i < bar_count; ++i) {
         if (bar_heights[i] > 0) {
             bar_heights[i] -= bar_periodic_step;
         }
     }
-
-    cairo_restore(ctx);
 }
 
 static void draw_indic(cairo_t *ctx, double ind_x, double ind_y) {
     if (unlock_indicator &&
-        (unlock_state >= STATE_KEY_PRESSED || auth_state > STATE_AUTH_IDLE || show_indicator)) {
+        (frame.unlock_state >= STATE_KEY_PRESSED || frame.auth_state > STATE_AUTH_IDLE || show_indicator)) {
         /* Draw a (centered) circle with transparent background. */
         cairo_set_line_width(ctx, RING_WIDTH);
         cairo_arc(ctx, ind_x, ind_y, BUTTON_RADIUS, 0, 2 * M_PI);
+        /* the highlights and the separators are all within the ring */
+        add_ink(ctx);
 
         /* Use the appropriate color for the different PAM states
          * (currently verifying, wrong password, or default) */
-        switch (auth_state) {
+        switch (frame.auth_state) {
             case STATE_AUTH_VERIFY:
             case STATE_AUTH_LOCK:
                 cairo_set_source_rgba(ctx, insidever16.red, insidever16.green, insidever16.blue, insidever16.alpha);
@@ -537,7 +717,7 @@ static void draw_indic(cairo_t *ctx, double ind_x, double ind_y) {
                 cairo_set_source_rgba(ctx, insidewrong16.red, insidewrong16.green, insidewrong16.blue, insidewrong16.alpha);
                 break;
             default:
-                if (unlock_state == STATE_NOTHING_TO_DELETE) {
+                if (frame.unlock_state == STATE_NOTHING_TO_DELETE) {
                     cairo_set_source_rgba(ctx, insidewrong16.red, insidewrong16.green, insidewrong16.blue, insidewrong16.alpha);
                     break;
                 }
@@ -546,7 +726,7 @@ static void draw_indic(cairo_t *ctx, double ind_x, double ind_y) {
         }
         cairo_fill_preserve(ctx);
 
-        switch (auth_state) {
+        switch (frame.auth_state) {
             case STATE_AUTH_VERIFY:
             case STATE_AUTH_LOCK:
                 cairo_set_source_rgba(ctx, ringver16.red, ringver16.green, ringver16.blue, ringver16.alpha);
@@ -568,7 +748,7 @@ static void draw_indic(cairo_t *ctx, double ind_x, double ind_y) {
                 }
                 break;
             case STATE_AUTH_IDLE:
-                if (unlock_state == STATE_NOTHING_TO_DELETE) {
+                if (frame.unlock_state == STATE_NOTHING_TO_DELETE) {
                     cairo_set_source_rgba(ctx, ringwrong16.red, ringwrong16.green, ringwrong16.blue, ringwrong16.alpha);
                     if (internal_line_source == 1) {
                         line16.red = ringwrong16.red;
@@ -596,13 +776,13 @@ static void draw_indic(cairo_t *ctx, double ind_x, double ind_y) {
             cairo_arc(ctx, ind_x, ind_y, BUTTON_RADIUS - 5, 0, 2 * M_PI);
             cairo_stroke(ctx);
         }
-        if (unlock_state == STATE_KEY_ACTIVE || unlock_state == STATE_BACKSPACE_ACTIVE) {
+        if (frame.unlock_state == STATE_KEY_ACTIVE || frame.unlock_state == STATE_BACKSPACE_ACTIVE) {
             cairo_set_line_width(ctx, RING_WIDTH);
             cairo_new_sub_path(ctx);
             double highlight_start = (rand() % (int)(2 * M_PI * 100)) / 100.0;
             cairo_arc(ctx, ind_x, ind_y, BUTTON_RADIUS,
                       highlight_start, highlight_start + (M_PI / 3.0));
-            if (unlock_state == STATE_KEY_ACTIVE) {
+            if (frame.unlock_state == STATE_KEY_ACTIVE) {
                 /* For normal keys, we use a lighter green. */
                 cairo_set_source_rgba(ctx, keyhl16.red, keyhl16.green, keyhl16.blue, keyhl16.alpha);
             } else {
@@ -723,29 +903,6 @@ static void draw_elements(cairo_t *const ctx, DrawData const *const draw_data) {
     if (!bar_enabled) {
         draw_indic(ctx, draw_data->indicator_x, draw_data->indicator_y);
     } else {
-        if (unlock_state == STATE_KEY_ACTIVE ||
-            unlock_state == STATE_BACKSPACE_ACTIVE) {
-            // note: might be biased to cause more hits on lower indices
-            // maybe see about doing ((double) rand() / RAND_MAX) * bar_count
-            int index = rand() % bar_count;
-            bar_heights[index] = max_bar_height;
-            for (int i = 0; i < ((max_bar_height / bar_step) + 1); ++i) {
-                int low_ind = index - i;
-                while (low_ind < 0) {
-                    low_ind += bar_count;
-                }
-                int high_ind = (index + i) % bar_count;
-                int tmp_height = max_bar_height - (bar_step * i);
-                if (tmp_height < 0)
-                    tmp_height = 0;
-                if (bar_heights[low_ind] < tmp_height)
-                    bar_heights[low_ind] = tmp_height;
-                if (bar_heights[high_ind] < tmp_height)
-                    bar_heights[high_ind] = tmp_height;
-                if (tmp_height == 0)
-                    break;
-            }
-        }
         draw_bar(ctx, draw_data->bar_x, draw_data->bar_y, draw_data->bar_width, draw_data->screen_x, draw_data->screen_y);
     }
 
@@ -757,6 +914,312 @@ static void draw_elements(cairo_t *const ctx, DrawData const *const draw_data) {
     draw_text(ctx, draw_data->greeter_text);
 }
 
+/* The variables the position expressions are evaluated with. They are
+ * compiled against these once, see compile_layout. */
+static double layout_width, layout_height, layout_screen_x, layout_screen_y, layout_radius;
+static DrawData layout_data;
+
+static te_expr *te_ind_x_expr, *te_ind_y_expr;
+static te_expr *te_time_x_expr, *te_time_y_expr;
+static te_expr *te_date_x_expr, *te_date_y_expr;
+static te_expr *te_layout_x_expr, *te_layout_y_expr;
+static te_expr *te_status_x_expr, *te_status_y_expr;
+static te_expr *te_verif_x_expr, *te_verif_y_expr;
+static te_expr *te_wrong_x_expr, *te_wrong_y_expr;
+static te_expr *te_modif_x_expr, *te_modif_y_expr;
+static te_expr *te_bar_x_expr, *te_bar_y_expr, *te_bar_width_expr;
+static te_expr *te_greeter_x_expr, *te_greeter_y_expr;
+
+/* Positions of everything on the monitors the indicator is drawn on,
+ * computed by update_layout until invalidate_layout is called. */
+static layout_t *layouts = NULL;
+static int layout_count = 0;
+
+/*
+ * Compiles the position expressions. They are given on the command line and
+ * never change, so this only happens once.
+ *
+ */
+static void compile_layout(void) {
+    static bool compiled = false;
+    if (compiled)
+        return;
+    compiled = true;
+
+    // variable mapping for evaluating the clock position expression
+    const unsigned int vars_size = 14;
+    te_variable vars[] =
+        {{"w", &layout_width},
+         {"h", &layout_height},
+         {"x", &layout_screen_x},
+         {"y", &layout_screen_y},
+         {"ix", &layout_data.indicator_x},
+         {"iy", &layout_data.indicator_y},
+         {"tx", &layout_data.time_text.x},
+         {"ty", &layout_data.time_text.y},
+         {"dx", &layout_data.date_text.x},
+         {"dy", &layout_data.date_text.y},
+         {"bw", &layout_data.bar_width},
+         {"bx", &layout_data.bar_x},
+         {"by", &layout_data.bar_y},
+         {"r", &layout_radius}};
+
+    te_ind_x_expr = compile_expression("--indpos", ind_x_expr, vars, vars_size);
+    te_ind_y_expr = compile_expression("--indpos", ind_y_expr, vars, vars_size);
+    te_time_x_expr = compile_expression("--timepos", time_x_expr, vars, vars_size);
+    te_time_y_expr = compile_expression("--timepos", time_y_expr, vars, vars_size);
+    te_date_x_expr = compile_expression("--datepos", date_x_expr, vars, vars_size);
+    te_date_y_expr = compile_expression("--datepos", date_y_expr, vars, vars_size);
+    te_layout_x_expr = compile_expression("--layoutpos", layout_x_expr, vars, vars_size);
+    te_layout_y_expr = compile_expression("--layoutpos", layout_y_expr, vars, vars_size);
+    te_status_x_expr = compile_expression("--statuspos", status_x_expr, vars, vars_size);
+    te_status_y_expr = compile_expression("--statuspos", status_y_expr, vars, vars_size);
+    te_verif_x_expr = compile_expression("--verifpos", verif_x_expr, vars, vars_size);
+    te_verif_y_expr = compile_expression("--verifpos", verif_y_expr, vars, vars_size);
+    te_wrong_x_expr = compile_expression("--wrongpos", wrong_x_expr, vars, vars_size);
+    te_wrong_y_expr = compile_expression("--wrongpos", wrong_y_expr, vars, vars_size);
+    te_modif_x_expr = compile_expression("--modifpos", modif_x_expr, vars, vars_size);
+    te_modif_y_expr = compile_expression("--modifpos", modif_y_expr, vars, vars_size);
+    te_bar_x_expr = compile_expression("--bar-position", bar_x_expr, vars, vars_size);
+    te_bar_y_expr = strlen(bar_y_expr) ? compile_expression("--bar-position", bar_y_expr, vars, vars_size) : NULL;
+    te_bar_width_expr = strlen(bar_width_expr) ? compile_expression("--bar-width", bar_width_expr, vars, vars_size) : NULL;
+
+    te_greeter_x_expr = compile_expression("--greeterpos", greeter_x_expr, vars, vars_size);
+    te_greeter_y_expr = compile_expression("--greeterpos", greeter_y_expr, vars, vars_size);
+}
+
+/*
+ * Evaluates the position expressions for the monitor at the current
+ * layout_screen_x/y of size layout_width/height into @layout. The
+ * expressions can refer to positions computed before them, so the order
+ * matters. All three positions of the status text are computed, since which
+ * one is used depends on auth_state at the time of drawing.
+ *
+ */
+static void evaluate_layout(layout_t *layout) {
+    layout->time_x = layout_data.time_text.x = te_eval(te_time_x_expr);
+    layout->time_y = layout_data.time_text.y = te_eval(te_time_y_expr);
+    layout->date_x = layout_data.date_text.x = te_eval(te_date_x_expr);
+    layout->date_y = layout_data.date_text.y = te_eval(te_date_y_expr);
+    layout->layout_x = te_eval(te_layout_x_expr);
+    layout->layout_y = te_eval(te_layout_y_expr);
+    layout->greeter_x = te_eval(te_greeter_x_expr);
+    layout->greeter_y = te_eval(te_greeter_y_expr);
+
+    layout->verif_x = te_eval(te_verif_x_expr);
+    layout->verif_y = te_eval(te_verif_y_expr);
+    layout->wrong_x = te_eval(te_wrong_x_expr);
+    layout->wrong_y = te_eval(te_wrong_y_expr);
+    layout->status_x = te_eval(te_status_x_expr);
+    layout->status_y = te_eval(te_status_y_expr);
+
+    layout->mod_x = te_eval(te_modif_x_expr);
+    layout->mod_y = te_eval(te_modif_y_expr);
+
+    if (te_bar_y_expr) {
+        layout_data.bar_x = te_eval(te_bar_x_expr);
+        layout_data.bar_y = te_eval(te_bar_y_expr);
+    } else {
+        double bar_offset = te_eval(te_bar_x_expr);
+        if (bar_orientation == BAR_VERT) {
+            layout_data.bar_x = bar_offset;
+            layout_data.bar_y = layout_screen_y;
+        } else {
+            layout_data.bar_x = layout_screen_x;
+            layout_data.bar_y = bar_offset;
+        }
+    }
+    if (te_bar_width_expr)
+        layout_data.bar_width = te_eval(te_bar_width_expr);
+    else if (bar_orientation == BAR_VERT)
+        layout_data.bar_width = layout_height;
+    else
+        layout_data.bar_width = layout_width;
+
+    layout->screen_x = layout_screen_x;
+    layout->screen_y = layout_screen_y;
+    layout->indicator_x = layout_data.indicator_x;
+    layout->indicator_y = layout_data.indicator_y;
+    layout->bar_x = layout_data.bar_x;
+    layout->bar_y = layout_data.bar_y;
+    layout->bar_width = layout_data.bar_width;
+
+    DEBUG("Indicator at %fx%f\n", layout->indicator_x, layout->indicator_y);
+    DEBUG("Bar at %fx%f with width %f\n", layout->bar_x, layout->bar_y, layout->bar_width);
+    DEBUG("Time at %fx%f\n", layout->time_x, layout->time_y);
+    DEBUG("Date at %fx%f\n", layout->date_x, layout->date_y);
+    DEBUG("Layout at %fx%f\n", layout->layout_x, layout->layout_y);
+    DEBUG("Status at %fx%f\n", layout->status_x, layout->status_y);
+    DEBUG("Mod at %fx%f\n", layout->mod_x, layout->mod_y);
+}
+
+/*
+ * Lays out everything on the monitors the indicator is drawn on, for the
+ * current monitor configuration.
+ *
+ */
+static void update_layout(double scaling_factor) {
+    compile_layout();
+
+    free(layouts);
+    layout_count = 0;
+    layouts = calloc(xr_screens > 0 ? xr_screens : 1, sizeof(layout_t));
+    if (layouts == NULL)
+        return;
+
+    memset(&layout_data, 0, sizeof(layout_data));
+    layout_radius = circle_radius + ring_width;
+
+    if (xr_screens > 0) {
+        if (screen_number < 0 || screen_number > xr_screens) {
+            screen_number = 0;
+        }
+
+        DEBUG("Drawing indicator on %d screens\n", screen_number);
+
+        int current_screen = screen_number == 0 ? 0 : screen_number - 1;
+        const int end_screen = screen_number == 0 ? xr_screens : screen_number;
+        for (; current_screen < end_screen; current_screen++) {
+            layout_data.indicator_x = 0;
+            layout_data.indicator_y = 0;
+            layout_data.time_text.x = 0;
+            layout_data.time_text.y = 0;
+            layout_data.date_text.x = 0;
+            layout_data.date_text.y = 0;
+
+            layout_width = xr_resolutions[current_screen].width / scaling_factor;
+            layout_height = xr_resolutions[current_screen].height / scaling_factor;
+            layout_screen_x = xr_resolutions[current_screen].x / scaling_factor;
+            layout_screen_y = xr_resolutions[current_screen].y / scaling_factor;
+            layout_data.indicator_x = te_eval(te_ind_x_expr);
+            layout_data.indicator_y = te_eval(te_ind_y_expr);
+
+            DEBUG("Layout of screen %d:\n", current_screen + 1);
+            evaluate_layout(&layouts[layout_count++]);
+        }
+    } else {
+        /* We have no information about the screen sizes/positions, so we just
+         * place the unlock indicator in the middle of the X root window and
+         * hope for the best. */
+        layout_width = last_resolution[0] / scaling_factor;
+        layout_height = last_resolution[1] / scaling_factor;
+        layout_screen_x = 0;
+        layout_screen_y = 0;
+        layout_data.indicator_x = layout_width / 2;
+        layout_data.indicator_y = layout_height / 2;
+
+        evaluate_layout(&layouts[layout_count++]);
+    }
+}
+
+/*
+ * Drops the layout, so that the next redraw computes it for the new monitor
+ * configuration.
+ *
+ */
+void invalidate_layout(void) {
+    free(layouts);
+    layouts = NULL;
+    layout_count = 0;
+}
+
+/*
+ * Drops the cached background, so that render_lock paints it again.
+ *
+ */
+static void drop_background(void) {
+    if (bg_cache == NULL)
+        return;
+
+    cairo_surface_destroy(bg_cache);
+    xcb_free_pixmap(render_conn, bg_cache_pixmap);
+    bg_cache = NULL;
+}
+
+/*
+ * Draws everything below the unlock indicator: the background color, the
+ * blurred screenshots and the image, scaled or tiled according to bg_type.
+ *
+ */
+static void draw_background(uint32_t *resolution, cairo_t *ctx) {
+    if (frame.blur_bg_count > 0) {
+        /* Only the monitors were blurred, fill what none of them shows. */
+        cairo_rectangle_int_t root = {0, 0, resolution[0], resolution[1]};
+        cairo_region_t *uncovered = cairo_region_create_rectangle(&root);
+        /* The screenshots are opaque and already carry every effect, so
+         * they are copied as they are. */
+        cairo_set_operator(ctx, CAIRO_OPERATOR_SOURCE);
+        for (int i = 0; i < frame.blur_bg_count; i++) {
+            Rect rect = blur_bg_rects[i];
+            cairo_rectangle_int_t area = {rect.x, rect.y, rect.width, rect.height};
+            cairo_region_subtract_rectangle(uncovered, &area);
+
+            cairo_set_source_surface(ctx, frame.blur_bg_imgs[i], rect.x, rect.y);
+            cairo_rectangle(ctx, rect.x, rect.y, rect.width, rect.height);
+            cairo_fill(ctx);
+        }
+        cairo_set_operator(ctx, CAIRO_OPERATOR_OVER);
+        cairo_set_source_rgba(ctx, background.red, background.green, background.blue, background.alpha);
+        for (int i = 0; i < cairo_region_num_rectangles(uncovered); i++) {
+            cairo_rectangle_int_t area;
+            cairo_region_get_rectangle(uncovered, i, &area);
+            cairo_rectangle(ctx, area.x, area.y, area.width, area.height);
+        }
+        cairo_fill(ctx);
+        cairo_region_destroy(uncovered);
+    } else {
+        cairo_set_source_rgba(ctx, background.red, background.green, background.blue, background.alpha);
+        cairo_rectangle(ctx, 0, 0, resolution[0], resolution[1]);
+        cairo_fill(ctx);
+    }
+
+    cairo_surface_t *image = slideshow_img ? slideshow_img : frame.img;
+    if (image) {
+        draw_image(resolution, image, ctx);
+    }
+}
+
+/*
+ * Places the elements of @draw_data on the monitor of @layout.
+ *
+ */
+static void place_elements(DrawData *draw_data, const layout_t *layout) {
+    draw_data->screen_x = layout->screen_x;
+    draw_data->screen_y = layout->screen_y;
+    draw_data->indicator_x = layout->indicator_x;
+    draw_data->indicator_y = layout->indicator_y;
+    draw_data->time_text.x = layout->time_x;
+    draw_data->time_text.y = layout->time_y;
+    draw_data->date_text.x = layout->date_x;
+    draw_data->date_text.y = layout->date_y;
+    draw_data->keylayout_text.x = layout->layout_x;
+    draw_data->keylayout_text.y = layout->layout_y;
+    draw_data->greeter_text.x = layout->greeter_x;
+    draw_data->greeter_text.y = layout->greeter_y;
+    draw_data->mod_text.x = layout->mod_x;
+    draw_data->mod_text.y = layout->mod_y;
+    draw_data->bar_x = layout->bar_x;
+    draw_data->bar_y = layout->bar_y;
+    draw_data->bar_width = layout->bar_width;
+
+    switch (frame.auth_state) {
+        case STATE_AUTH_VERIFY:
+        case STATE_AUTH_LOCK:
+            draw_data->status_text.x = layout->verif_x;
+            draw_data->status_text.y = layout->verif_y;
+            break;
+        case STATE_AUTH_WRONG:
+        case STATE_I3LOCK_LOCK_FAILED:
+            draw_data->status_text.x = layout->wrong_x;
+            draw_data->status_text.y = layout->wrong_y;
+            break;
+        default:
+            draw_data->status_text.x = layout->status_x;
+            draw_data->status_text.y = layout->status_y;
+            break;
+    }
+}
+
 /*
  * Renders the lock screen on the provided drawable with the given resolution.
  */
@@ -771,25 +1234,70 @@ void render_lock(uint32_t *resolution, xcb_drawable_t drawable) {
     /* Initialize cairo: Create one in-memory surface to render the unlock
      * indicator on, create one XCB surface to actually draw (one or more,
      * depending on the amount of screens) unlock indicators on.
-     * create two more surfaces for time and date display
+     * Both are only created once per resolution; later redraws point the
+     * XCB surface at their drawable and only clear what the last frame drew
+     * on the in-memory surface.
+     * A drawable is drawn in full the first time, later only where something
+     * changed since it was last drawn on, see render_targets.
      */
-    cairo_surface_t *output = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, resolution[0], resolution[1]);
-    cairo_t *ctx = cairo_create(output);
+    render_target_t *target = NULL;
+    for (int i = 0; i < SCREEN_BUFFERS; i++) {
+        if (render_targets[i].drawable == drawable)
+            target = &render_targets[i];
+    }
+    if (target == NULL) {
+        target = &render_targets[render_target_next];
+        render_target_next = (render_target_next + 1) % SCREEN_BUFFERS;
+        target->drawable = drawable;
+        if (target->stale != NULL)
+            cairo_region_destroy(target->stale);
+        target->stale = NULL;
+    }
+    bool full = (target->stale == NULL);
+    bool new_background = false;
+    if (render_output == NULL) {
+        render_output = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, resolution[0], resolution[1]);
+        render_ctx = cairo_create(render_output);
+        render_xcb_output = cairo_xcb_surface_create(render_conn, drawable, vistype, resolution[0], resolution[1]);
+        render_xcb_ctx = cairo_create(render_xcb_output);
+        frame_ink = cairo_region_create();
+        last_ink = cairo_region_create();
+        render_damage = cairo_region_create();
+        full = true;
+    } else if (drawable != render_drawable) {
+        cairo_xcb_surface_set_drawable(render_xcb_output, drawable, resolution[0], resolution[1]);
+    }
+    render_drawable = drawable;
+    cairo_surface_t *output = render_output;
+    cairo_t *ctx = render_ctx;
+    cairo_t *xcb_ctx = render_xcb_ctx;
+
+    /* everything set below is undone by the cairo_restore calls at the end,
+     * except for the path, which is not part of the saved state */
+    cairo_save(ctx);
+    cairo_save(xcb_ctx);
+    cairo_new_path(ctx);
+    cairo_new_path(xcb_ctx);
+    cairo_set_operator(ctx, CAIRO_OPERATOR_CLEAR);
+    for (int i = 0; i < cairo_region_num_rectangles(last_ink); i++) {
+        cairo_rectangle_int_t area;
+        cairo_region_get_rectangle(last_ink, i, &area);
+        cairo_rectangle(ctx, area.x, area.y, area.width, area.height);
+    }
+    cairo_fill(ctx);
+    cairo_set_operator(ctx, CAIRO_OPERATOR_OVER);
     cairo_scale(ctx, scaling_factor, scaling_factor);
 
     //    cairo_set_font_face(ctx, get_font_face(0));
 
-    cairo_surface_t *xcb_output = cairo_xcb_surface_create(conn, drawable, vistype, resolution[0], resolution[1]);
-    cairo_t *xcb_ctx = cairo_create(xcb_output);
-
     /*update image according to the slideshow_interval*/
     if (slideshow_image_count > 0) {
         unsigned long now = (unsigned long)time(NULL);
-        if (img == NULL || now - lastCheck >= slideshow_interval) {
+        if ((slideshow_img == NULL && frame.img == NULL) || now - lastCheck >= slideshow_interval) {
             if (slideshow_random_selection) {
-                img = load_image(img_slideshow[rand() % slideshow_image_count]);
+                slideshow_img = load_image(img_slideshow[rand() % slideshow_image_count]);
             } else {
-                img = load_image(img_slideshow[current_slideshow_index]);
+                slideshow_img = load_image(img_slideshow[current_slideshow_index]);
             }
             current_slideshow_index++;
             if (current_slideshow_index >= slideshow_image_count) {
@@ -797,20 +1305,25 @@ void render_lock(uint32_t *resolution, xcb_drawable_t drawable) {
                 load_slideshow_images(slideshow_path);
             }
             lastCheck = now;
+            drop_background();
         }
     }
 
-    if (blur_bg_img) {
-        cairo_set_source_surface(xcb_ctx, blur_bg_img, 0, 0);
-        cairo_paint(xcb_ctx);
-    } else {
-        cairo_set_source_rgba(xcb_ctx, background.red, background.green, background.blue, background.alpha);
-        cairo_rectangle(xcb_ctx, 0, 0, resolution[0], resolution[1]);
-        cairo_fill(xcb_ctx);
-    }
-
-    if (img) {
-        draw_image(resolution, img, xcb_ctx);
+    if (frame.new_background)
+        drop_background();
+    if (bg_cache == NULL) {
+        bg_cache_pixmap = create_bg_pixmap(render_conn, win, resolution, color);
+        bg_cache = cairo_xcb_surface_create(render_conn, bg_cache_pixmap, vistype, resolution[0], resolution[1]);
+        cairo_t *bg_ctx = cairo_create(bg_cache);
+        draw_background(resolution, bg_ctx);
+        cairo_destroy(bg_ctx);
+        cairo_surface_flush(bg_cache);
+        /* The X server keeps no order between connections, so the copies
+         * must be done before background_shown lets conn change what they
+         * were copied from. */
+        if (render_conn != conn)
+            xcb_aux_sync(render_conn);
+        new_background = true;
     }
 
     /*
@@ -823,8 +1336,8 @@ void render_lock(uint32_t *resolution, xcb_drawable_t drawable) {
     DrawData draw_data = create_draw_data();
 
     if (unlock_indicator &&
-        (unlock_state >= STATE_KEY_PRESSED || auth_state > STATE_AUTH_IDLE || show_indicator)) {
-        switch (auth_state) {
+        (frame.unlock_state >= STATE_KEY_PRESSED || frame.auth_state > STATE_AUTH_IDLE || show_indicator)) {
+        switch (frame.auth_state) {
             case STATE_AUTH_VERIFY:
                 draw_data.status_text.show = true;
                 strncpy(draw_data.status_text.str, verif_text, sizeof(draw_data.status_text.str) - 1);
@@ -866,7 +1379,7 @@ void render_lock(uint32_t *resolution, xcb_drawable_t drawable) {
                 draw_data.status_text.align = wrong_align;
                 break;
             default:
-                if (unlock_state == STATE_NOTHING_TO_DELETE) {
+                if (frame.unlock_state == STATE_NOTHING_TO_DELETE) {
                     draw_data.status_text.show = true;
                     strncpy(draw_data.status_text.str, noinput_text, sizeof(draw_data.status_text.str) - 1);
                     draw_data.status_text.font = get_font_face(WRONG_FONT);
@@ -877,7 +1390,7 @@ void render_lock(uint32_t *resolution, xcb_drawable_t drawable) {
                     draw_data.status_text.align = wrong_align;
                     break;
                 }
-                if (show_failed_attempts && failed_attempts > 0) {
+                if (show_failed_attempts && frame.failed_attempts > 0) {
                     draw_data.status_text.show = true;
                     draw_data.status_text.font = get_font_face(WRONG_FONT);
                     draw_data.status_text.color = wrong16;
@@ -887,19 +1400,19 @@ void render_lock(uint32_t *resolution, xcb_drawable_t drawable) {
                     draw_data.status_text.align = wrong_align;
                     // TODO: variable for this
                     draw_data.status_text.size = 32.0;
-                    if (failed_attempts > 999) {
+                    if (frame.failed_attempts > 999) {
                         strncpy(draw_data.status_text.str, "> 999", sizeof(draw_data.status_text.str));
                     } else {
-                        snprintf(draw_data.status_text.str, sizeof(draw_data.status_text.str), "%d", failed_attempts);
+                        snprintf(draw_data.status_text.str, sizeof(draw_data.status_text.str), "%d", frame.failed_attempts);
                     }
                 }
                 break;
         }
     }
 
-    if (modifier_string) {
+    if (frame.show_modifiers) {
         draw_data.mod_text.show = true;
-        strncpy(draw_data.mod_text.str, modifier_string, sizeof(draw_data.mod_text.str) - 1);
+        strncpy(draw_data.mod_text.str, frame.modifiers, sizeof(draw_data.mod_text.str) - 1);
         draw_data.mod_text.size = modifier_size;
         draw_data.mod_text.outline_width = modifieroutlinewidth;
         draw_data.mod_text.font = get_font_face(WRONG_FONT);
@@ -908,9 +1421,9 @@ void render_lock(uint32_t *resolution, xcb_drawable_t drawable) {
         draw_data.mod_text.outline_color = modifoutline16;
     }
 
-    if (layout_text) {
+    if (frame.show_layout) {
         draw_data.keylayout_text.show = true;
-        strncpy(draw_data.keylayout_text.str, layout_text, sizeof(draw_data.keylayout_text.str) - 1);
+        strncpy(draw_data.keylayout_text.str, frame.layout, sizeof(draw_data.keylayout_text.str) - 1);
         draw_data.keylayout_text.size = layout_size;
         draw_data.keylayout_text.outline_width = layoutoutlinewidth;
         draw_data.keylayout_text.font = get_font_face(LAYOUT_FONT);
@@ -968,241 +1481,132 @@ void render_lock(uint32_t *resolution, xcb_drawable_t drawable) {
         }
     }
 
-    // initialize positioning vars
-    double screen_x = 0, screen_y = 0,
-           width = 0, height = 0;
-
-    double radius = (circle_radius + ring_width);
     DEBUG("scaling_factor is %f, physical diameter is %d px\n",
           scaling_factor, button_diameter_physical);
 
-    // variable mapping for evaluating the clock position expression
-    const unsigned int vars_size = 14;
-    te_variable vars[] =
-        {{"w", &width},
-         {"h", &height},
-         {"x", &screen_x},
-         {"y", &screen_y},
-         {"ix", &draw_data.indicator_x},
-         {"iy", &draw_data.indicator_y},
-         {"tx", &draw_data.time_text.x},
-         {"ty", &draw_data.time_text.y},
-         {"dx", &draw_data.date_text.x},
-         {"dy", &draw_data.date_text.y},
-         {"bw", &draw_data.bar_width},
-         {"bx", &draw_data.bar_x},
-         {"by", &draw_data.bar_y},
-         {"r", &radius}};
-
-    te_expr *te_ind_x_expr = compile_expression("--indpos", ind_x_expr, vars, vars_size);
-    te_expr *te_ind_y_expr = compile_expression("--indpos", ind_y_expr, vars, vars_size);
-    te_expr *te_time_x_expr = compile_expression("--timepos", time_x_expr, vars, vars_size);
-    te_expr *te_time_y_expr = compile_expression("--timepos", time_y_expr, vars, vars_size);
-    te_expr *te_date_x_expr = compile_expression("--datepos", date_x_expr, vars, vars_size);
-    te_expr *te_date_y_expr = compile_expression("--datepos", date_y_expr, vars, vars_size);
-    te_expr *te_layout_x_expr = compile_expression("--layoutpos", layout_x_expr, vars, vars_size);
-    te_expr *te_layout_y_expr = compile_expression("--layoutpos", layout_y_expr, vars, vars_size);
-    te_expr *te_status_x_expr = compile_expression("--statuspos", status_x_expr, vars, vars_size);
-    te_expr *te_status_y_expr = compile_expression("--statuspos", status_y_expr, vars, vars_size);
-    te_expr *te_verif_x_expr = compile_expression("--verifpos", verif_x_expr, vars, vars_size);
-    te_expr *te_verif_y_expr = compile_expression("--verifpos", verif_y_expr, vars, vars_size);
-    te_expr *te_wrong_x_expr = compile_expression("--wrongpos", wrong_x_expr, vars, vars_size);
-    te_expr *te_wrong_y_expr = compile_expression("--wrongpos", wrong_y_expr, vars, vars_size);
-    te_expr *te_modif_x_expr = compile_expression("--modifpos", modif_x_expr, vars, vars_size);
-    te_expr *te_modif_y_expr = compile_expression("--modifpos", modif_y_expr, vars, vars_size);
-    te_expr *te_bar_x_expr = compile_expression("--bar-position", bar_x_expr, vars, vars_size);
-    te_expr *te_bar_y_expr = strlen(bar_y_expr) ? compile_expression("--bar-position", bar_y_expr, vars, vars_size) : NULL;
-    te_expr *te_bar_width_expr = strlen(bar_width_expr) ? compile_expression("--bar-width", bar_width_expr, vars, vars_size) : NULL;
-
-    te_expr *te_greeter_x_expr = compile_expression("--greeterpos", greeter_x_expr, vars, vars_size);
-    te_expr *te_greeter_y_expr = compile_expression("--greeterpos", greeter_y_expr, vars, vars_size);
-
-    if (xr_screens > 0) {
-        if (screen_number < 0 || screen_number > xr_screens) {
-            screen_number = 0;
-        }
-
-        DEBUG("Drawing indicator on %d screens\n", screen_number);
-
-        int current_screen = screen_number == 0 ? 0 : screen_number - 1;
-        const int end_screen = screen_number == 0 ? xr_screens : screen_number;
-        for (; current_screen < end_screen; current_screen++) {
-            draw_data.indicator_x = 0;
-            draw_data.indicator_y = 0;
-            draw_data.time_text.x = 0;
-            draw_data.time_text.y = 0;
-            draw_data.date_text.x = 0;
-            draw_data.date_text.y = 0;
-            draw_data.greeter_text.x = 0;
-            draw_data.greeter_text.y = 0;
-
-            width = xr_resolutions[current_screen].width / scaling_factor;
-            height = xr_resolutions[current_screen].height / scaling_factor;
-            screen_x = xr_resolutions[current_screen].x / scaling_factor;
-            screen_y = xr_resolutions[current_screen].y / scaling_factor;
-            draw_data.screen_x = screen_x;
-            draw_data.screen_y = screen_y;
-            draw_data.indicator_x = te_eval(te_ind_x_expr);
-            draw_data.indicator_y = te_eval(te_ind_y_expr);
-            draw_data.time_text.x = te_eval(te_time_x_expr);
-            draw_data.time_text.y = te_eval(te_time_y_expr);
-            draw_data.date_text.x = te_eval(te_date_x_expr);
-            draw_data.date_text.y = te_eval(te_date_y_expr);
-            draw_data.keylayout_text.x = te_eval(te_layout_x_expr);
-            draw_data.keylayout_text.y = te_eval(te_layout_y_expr);
-            draw_data.greeter_text.x = te_eval(te_greeter_x_expr);
-            draw_data.greeter_text.y = te_eval(te_greeter_y_expr);
-
-            switch (auth_state) {
-                case STATE_AUTH_VERIFY:
-                case STATE_AUTH_LOCK:
-                    draw_data.status_text.x = te_eval(te_verif_x_expr);
-                    draw_data.status_text.y = te_eval(te_verif_y_expr);
-                    break;
-                case STATE_AUTH_WRONG:
-                case STATE_I3LOCK_LOCK_FAILED:
-                    draw_data.status_text.x = te_eval(te_wrong_x_expr);
-                    draw_data.status_text.y = te_eval(te_wrong_y_expr);
-                    break;
-                default:
-                    draw_data.status_text.x = te_eval(te_status_x_expr);
-                    draw_data.status_text.y = te_eval(te_status_y_expr);
-                    break;
-            }
-
-            draw_data.mod_text.x = te_eval(te_modif_x_expr);
-            draw_data.mod_text.y = te_eval(te_modif_y_expr);
+    if (layouts == NULL)
+        update_layout(scaling_factor);
 
-            if (te_bar_y_expr) {
-                draw_data.bar_x = te_eval(te_bar_x_expr);
-                draw_data.bar_y = te_eval(te_bar_y_expr);
-            } else {
-                double bar_offset = te_eval(te_bar_x_expr);
-                if (bar_orientation == BAR_VERT) {
-                    draw_data.bar_x = bar_offset;
-                    draw_data.bar_y = screen_y;
-                } else {
-                    draw_data.bar_x = screen_x;
-                    draw_data.bar_y = bar_offset;
-                }
-            }
-            if (te_bar_width_expr)
-                draw_data.bar_width = te_eval(te_bar_width_expr);
-            else if (bar_orientation == BAR_VERT)
-                draw_data.bar_width = height;
-            else
-                draw_data.bar_width = width;
-
-
-            DEBUG("Indicator at %fx%f on screen %d\n", draw_data.indicator_x, draw_data.indicator_y, current_screen + 1);
-            DEBUG("Bar at %fx%f with width %f on screen %d\n", draw_data.bar_x, draw_data.bar_y, draw_data.bar_width, current_screen + 1);
-            DEBUG("Time at %fx%f on screen %d\n", draw_data.time_text.x, draw_data.time_text.y, current_screen + 1);
-            DEBUG("Date at %fx%f on screen %d\n", draw_data.date_text.x, draw_data.date_text.y, current_screen + 1);
-            DEBUG("Layout at %fx%f on screen %d\n", draw_data.keylayout_text.x, draw_data.keylayout_text.y, current_screen + 1);
-            DEBUG("Status at %fx%f on screen %d\n", draw_data.status_text.x, draw_data.status_text.y, current_screen + 1);
-            DEBUG("Mod at %fx%f on screen %d\n", draw_data.mod_text.x, draw_data.mod_text.y, current_screen + 1);
-            // scale_draw_data(&draw_data, scaling_factor);
-            draw_elements(ctx, &draw_data);
-        }
+    if (bar_enabled)
+        raise_bar_heights();
+    for (int i = 0; i < layout_count; i++) {
+        place_elements(&draw_data, &layouts[i]);
+        draw_elements(ctx, &draw_data);
+    }
+    if (bar_enabled)
+        lower_bar_heights();
+
+    /* what differs from the last frame */
+    cairo_rectangle_int_t root = {0, 0, resolution[0], resolution[1]};
+    cairo_region_t *changed = cairo_region_copy(last_ink);
+    cairo_region_union(changed, frame_ink);
+    cairo_region_intersect_rectangle(changed, &root);
+
+    cairo_region_destroy(render_damage);
+    if (full || new_background) {
+        render_damage = cairo_region_create_rectangle(&root);
     } else {
-        /* We have no information about the screen sizes/positions, so we just
-         * place the unlock indicator in the middle of the X root window and
-         * hope for the best. */
-        width = last_resolution[0] / scaling_factor;
-        height = last_resolution[1] / scaling_factor;
-        draw_data.screen_x = 0;
-        draw_data.screen_y = 0;
-        draw_data.indicator_x = width / 2;
-        draw_data.indicator_y = height / 2;
-
-        draw_data.time_text.x = te_eval(te_time_x_expr);
-        draw_data.time_text.y = te_eval(te_time_y_expr);
-        draw_data.date_text.x = te_eval(te_date_x_expr);
-        draw_data.date_text.y = te_eval(te_date_y_expr);
-        draw_data.keylayout_text.x = te_eval(te_layout_x_expr);
-        draw_data.keylayout_text.y = te_eval(te_layout_y_expr);
-        draw_data.greeter_text.x = te_eval(te_greeter_x_expr);
-        draw_data.greeter_text.y = te_eval(te_greeter_y_expr);
-        switch (auth_state) {
-            case STATE_AUTH_VERIFY:
-            case STATE_AUTH_LOCK:
-                draw_data.status_text.x = te_eval(te_verif_x_expr);
-                draw_data.status_text.y = te_eval(te_verif_y_expr);
-                break;
-            case STATE_AUTH_WRONG:
-            case STATE_I3LOCK_LOCK_FAILED:
-                draw_data.status_text.x = te_eval(te_wrong_x_expr);
-                draw_data.status_text.y = te_eval(te_wrong_y_expr);
-                break;
-            default:
-                draw_data.status_text.x = te_eval(te_status_x_expr);
-                draw_data.status_text.y = te_eval(te_status_y_expr);
-                break;
-        }
-        draw_data.mod_text.x = te_eval(te_modif_x_expr);
-        draw_data.mod_text.y = te_eval(te_modif_y_expr);
-
-        if (te_bar_y_expr) {
-            draw_data.bar_x = te_eval(te_bar_x_expr);
-            draw_data.bar_y = te_eval(te_bar_y_expr);
+        render_damage = target->stale;
+        cairo_region_union(render_damage, changed);
+    }
+    target->stale = cairo_region_create();
+    for (int i = 0; i < SCREEN_BUFFERS; i++) {
+        render_target_t *other = &render_targets[i];
+        if (other == target || other->stale == NULL)
+            continue;
+        if (new_background) {
+            cairo_region_destroy(other->stale);
+            other->stale = NULL;
         } else {
-            double bar_offset = te_eval(te_bar_x_expr);
-            if (bar_orientation == BAR_VERT) {
-                draw_data.bar_x = bar_offset;
-                draw_data.bar_y = screen_y;
-            } else {
-                draw_data.bar_x = screen_x;
-                draw_data.bar_y = bar_offset;
-            }
+            cairo_region_union(other->stale, changed);
         }
-        if (te_bar_width_expr)
-            draw_data.bar_width = te_eval(te_bar_width_expr);
-        else if (bar_orientation == BAR_VERT)
-            draw_data.bar_width = height;
-        else
-            draw_data.bar_width = width;
-
-        DEBUG("Indicator at %fx%f\n", draw_data.indicator_x, draw_data.indicator_y);
-        DEBUG("Bar at %fx%f with width %f\n", draw_data.bar_x, draw_data.bar_y, draw_data.bar_width);
-        DEBUG("Time at %fx%f\n", draw_data.time_text.x, draw_data.time_text.y);
-        DEBUG("Date at %fx%f\n", draw_data.date_text.x, draw_data.date_text.y);
-        DEBUG("Layout at %fx%f\n", draw_data.keylayout_text.x, draw_data.keylayout_text.y);
-        DEBUG("Status at %fx%f\n", draw_data.status_text.x, draw_data.status_text.y);
-        DEBUG("Mod at %fx%f\n", draw_data.mod_text.x, draw_data.mod_text.y);
-
-        draw_elements(ctx, &draw_data);
     }
+    cairo_region_destroy(changed);
+    cairo_region_destroy(last_ink);
+    last_ink = frame_ink;
+    frame_ink = cairo_region_create();
+
+    long damaged_pixels = 0;
+    for (int i = 0; i < cairo_region_num_rectangles(render_damage); i++) {
+        cairo_rectangle_int_t area;
+        cairo_region_get_rectangle(render_damage, i, &area);
+        cairo_rectangle(xcb_ctx, area.x, area.y, area.width, area.height);
+        damaged_pixels += (long)area.width * area.height;
+    }
+    DEBUG("redrawing %ld px in %d rectangles\n", damaged_pixels, cairo_region_num_rectangles(render_damage));
+    cairo_clip(xcb_ctx);
+
+    /* both live on the server, so this is a plain copy there */
+    cairo_set_operator(xcb_ctx, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(xcb_ctx, bg_cache, 0, 0);
+    cairo_paint(xcb_ctx);
+    cairo_set_operator(xcb_ctx, CAIRO_OPERATOR_OVER);
+    /* only the clipped part is uploaded */
+    cairo_set_source_surface(xcb_ctx, output, 0, 0);
+    cairo_paint(xcb_ctx);
 
-    te_free(te_ind_x_expr);
-    te_free(te_ind_y_expr);
-    te_free(te_time_x_expr);
-    te_free(te_time_y_expr);
-    te_free(te_date_x_expr);
-    te_free(te_date_y_expr);
-    te_free(te_layout_x_expr);
-    te_free(te_layout_y_expr);
-    te_free(te_status_x_expr);
-    te_free(te_status_y_expr);
-    te_free(te_verif_x_expr);
-    te_free(te_verif_y_expr);
-    te_free(te_wrong_x_expr);
-    te_free(te_wrong_y_expr);
-    te_free(te_modif_x_expr);
-    te_free(te_modif_y_expr);
-    te_free(te_bar_x_expr);
-    te_free(te_bar_y_expr);
-    te_free(te_bar_width_expr);
-    te_free(te_greeter_x_expr);
-    te_free(te_greeter_y_expr);
+    cairo_restore(ctx);
+    cairo_restore(xcb_ctx);
+    /* the caller may free the drawable right after */
+    cairo_surface_flush(render_xcb_output);
+}
 
-    cairo_set_source_surface(xcb_ctx, output, 0, 0);
-    cairo_rectangle(xcb_ctx, 0, 0, resolution[0], resolution[1]);
-    cairo_fill(xcb_ctx);
+/*
+ * Destroys the surfaces render_lock keeps across redraws, so that the next
+ * redraw creates them for the new resolution.
+ *
+ */
+void release_render_surfaces(void) {
+    drop_background();
+    if (render_output == NULL)
+        return;
 
-    cairo_surface_destroy(xcb_output);
-    cairo_surface_destroy(output);
-    cairo_destroy(ctx);
-    cairo_destroy(xcb_ctx);
+    cairo_destroy(render_ctx);
+    cairo_destroy(render_xcb_ctx);
+    cairo_surface_destroy(render_output);
+    cairo_surface_destroy(render_xcb_output);
+    cairo_region_destroy(frame_ink);
+    cairo_region_destroy(last_ink);
+    cairo_region_destroy(render_damage);
+    render_output = NULL;
+    render_ctx = NULL;
+    render_xcb_output = NULL;
+    render_xcb_ctx = NULL;
+    render_drawable = XCB_NONE;
+
+    for (int i = 0; i < SCREEN_BUFFERS; i++) {
+        if (render_targets[i].stale != NULL)
+            cairo_region_destroy(render_targets[i].stale);
+        render_targets[i].drawable = XCB_NONE;
+        render_targets[i].stale = NULL;
+
+        /* the X server keeps a pixmap it is presenting until it is done */
+        if (screen_pixmaps[i] != XCB_NONE)
+            xcb_free_pixmap(render_conn, screen_pixmaps[i]);
+        screen_pixmaps[i] = XCB_NONE;
+        screen_pixmap_busy[i] = false;
+    }
+}
+
+/*
+ * Has the cached background painted again with the next frame, for when the
+ * screenshots, the image or the monitor layout have changed. Returns a serial
+ * to pass to background_shown.
+ *
+ */
+unsigned int invalidate_background(void) {
+    background_stale = true;
+    return ++background_serial;
+}
+
+/*
+ * Whether a frame drawn since invalidate_background returned @serial is done
+ * reading the surfaces the background is painted from. Safe to call from any
+ * thread.
+ *
+ */
+bool background_shown(unsigned int serial) {
+    return (int)(atomic_load(&background_drawn) - serial) >= 0;
 }
 
 /**
@@ -1266,17 +1670,106 @@ void draw_image(uint32_t* root_resolution, cairo_surface_t *img, cairo_t* xcb_ct
 }
 
 /*
- * Calls render_lock on a new pixmap and swaps that with the current pixmap
+ * Calls render_lock on the next pixmap of the pool, makes that the window
+ * background and shows the parts of it that changed.
  *
  */
 void redraw_screen(void) {
-    DEBUG("redraw_screen(unlock_state = %d, auth_state = %d) @ [%lu]\n", unlock_state, auth_state, (unsigned long)time(NULL));
-    xcb_pixmap_t pixmap = create_bg_pixmap(conn, win, last_resolution, color);
+    DEBUG("redraw_screen(unlock_state = %d, auth_state = %d) @ [%lu]\n", frame.unlock_state, frame.auth_state, (unsigned long)time(NULL));
+    if (render_conn == NULL)
+        render_conn = conn;
+    if (screen_pixmap_busy[screen_pixmap_next]) {
+        /* redraw_now does not wait for the X server to be done with it,
+         * which keeps it for as long as it still uses it */
+        xcb_free_pixmap(render_conn, screen_pixmaps[screen_pixmap_next]);
+        screen_pixmaps[screen_pixmap_next] = XCB_NONE;
+        screen_pixmap_busy[screen_pixmap_next] = false;
+    }
+    xcb_pixmap_t pixmap = screen_pixmaps[screen_pixmap_next];
+    if (pixmap == XCB_NONE) {
+        /* No need to fill it like create_bg_pixmap does, render_lock
+         * copies the background over all of it the first time. */
+        pixmap = xcb_generate_id(render_conn);
+        xcb_create_pixmap(render_conn, 32, pixmap, win, last_resolution[0], last_resolution[1]);
+        screen_pixmaps[screen_pixmap_next] = pixmap;
+    }
+    const int buffer = screen_pixmap_next;
+    screen_pixmap_next = (screen_pixmap_next + 1) % SCREEN_BUFFERS;
+
     render_lock(last_resolution, pixmap);
-    xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){pixmap});
-    xcb_clear_area(conn, 0, win, 0, 0, last_resolution[0], last_resolution[1]);
-    xcb_free_pixmap(conn, pixmap);
-    xcb_flush(conn);
+    /* the screenshots were copied into the cached background by now */
+    atomic_store(&background_drawn, frame.background_serial);
+    /* the background still covers up after exposures */
+    xcb_change_window_attributes(render_conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){pixmap});
+    if (present_opcode) {
+        /* at the first vblank after the last frame was shown; one still
+         * pending for that vblank is skipped for this one */
+        xcb_present_pixmap(render_conn, win, pixmap, ++present_serial,
+                           XCB_NONE, XCB_NONE, 0, 0, XCB_NONE, XCB_NONE, XCB_NONE,
+                           XCB_PRESENT_OPTION_NONE, present_msc + 1, 0, 0, 0, NULL);
+        present_pending = true;
+        present_sent = ev_time();
+        screen_pixmap_busy[buffer] = true;
+        xcb_flush(render_conn);
+        return;
+    }
+    if (screen_behind) {
+        /* the damage is relative to frames that were never shown */
+        xcb_clear_area(render_conn, 0, win, 0, 0, 0, 0);
+        screen_behind = false;
+    }
+    for (int i = 0; i < cairo_region_num_rectangles(render_damage); i++) {
+        cairo_rectangle_int_t area;
+        cairo_region_get_rectangle(render_damage, i, &area);
+        xcb_clear_area(render_conn, 0, win, area.x, area.y, area.width, area.height);
+    }
+    xcb_flush(render_conn);
+}
+
+/*
+ * Shows frames through the Present extension from now on, if it was asked for
+ * with --present and the X server supports it.
+ *
+ */
+void start_present(void) {
+    if (!present)
+        return;
+
+    present_opcode = present_select_events(conn, win);
+    if (!present_opcode)
+        DEBUG("cannot use Present, updating the window background instead\n");
+}
+
+/*
+ * Keeps track of which frames the X server has shown and which pixmaps it is
+ * done with. A redraw that had to wait for either is drawn by
+ * frame_prepare_cb.
+ *
+ */
+void handle_present_event(xcb_generic_event_t *event) {
+    xcb_ge_generic_event_t *generic = (xcb_ge_generic_event_t *)event;
+    xcb_present_complete_notify_event_t *complete;
+    xcb_present_idle_notify_event_t *idle;
+
+    if (!present_opcode || generic->extension != present_opcode)
+        return;
+
+    switch (generic->event_type) {
+        case XCB_PRESENT_EVENT_COMPLETE_NOTIFY:
+            complete = (xcb_present_complete_notify_event_t *)event;
+            if (complete->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP || complete->serial != present_serial)
+                return;
+            present_msc = complete->msc;
+            present_pending = false;
+            break;
+        case XCB_PRESENT_EVENT_IDLE_NOTIFY:
+            idle = (xcb_present_idle_notify_event_t *)event;
+            for (int i = 0; i < SCREEN_BUFFERS; i++) {
+                if (screen_pixmaps[i] == idle->pixmap)
+                    screen_pixmap_busy[i] = false;
+            }
+            break;
+    }
 }
 
 /*
@@ -1289,20 +1782,344 @@ void clear_indicator(void) {
         unlock_state = STATE_STARTED;
     } else
         unlock_state = STATE_KEY_PRESSED;
-    redraw_screen();
+    schedule_redraw(REDRAW_INPUT);
+}
+
+/*
+ * Stops using Present when the X server did not show the last frame within
+ * PRESENT_TIMEOUT, e.g. because the window got unmapped. Later frames update
+ * the window background instead, starting with one that covers the window.
+ *
+ */
+static void give_up_present(void) {
+    DEBUG("the X server did not show the last frame in %.1f s, updating the window background instead\n",
+          PRESENT_TIMEOUT);
+    present_opcode = 0;
+    present_pending = false;
+    screen_behind = true;
+    for (int i = 0; i < SCREEN_BUFFERS; i++) {
+        if (!screen_pixmap_busy[i])
+            continue;
+        /* the X server keeps it for as long as it still uses it */
+        xcb_free_pixmap(render_conn, screen_pixmaps[i]);
+        screen_pixmaps[i] = XCB_NONE;
+        screen_pixmap_busy[i] = false;
+    }
+}
+
+/*
+ * Whether the next frame can be drawn now. With --present, that is once the
+ * last one has been shown and its pixmap is no longer used.
+ *
+ */
+static bool frame_ready(void) {
+    if (present_opcode && present_pending && ev_time() - present_sent > PRESENT_TIMEOUT)
+        give_up_present();
+    return !present_opcode || (!present_pending && !screen_pixmap_busy[screen_pixmap_next]);
+}
+
+/*
+ * Copies what the next frame shows from the main loop's state, and starts
+ * over with the redraws asked for.
+ *
+ */
+static void capture_frame(frame_t *next) {
+    next->reasons = redraw_reasons;
+    /* the key handlers are back at STATE_KEY_PRESSED by now */
+    next->unlock_state = unlock_state;
+    if (highlight_state != STATE_STARTED && unlock_state == STATE_KEY_PRESSED)
+        next->unlock_state = highlight_state;
+    next->auth_state = auth_state;
+    next->failed_attempts = failed_attempts;
+    next->blur_bg_count = blur_bg_count;
+    next->blur_bg_imgs = blur_bg_imgs;
+    next->img = img;
+    next->new_background = background_stale;
+    next->background_serial = background_serial;
+
+    next->show_modifiers = (modifier_string != NULL);
+    if (next->show_modifiers)
+        snprintf(next->modifiers, sizeof(next->modifiers), "%s", modifier_string);
+    next->show_layout = (layout_text != NULL);
+    if (next->show_layout)
+        snprintf(next->layout, sizeof(next->layout), "%s", layout_text);
+
+    redraw_reasons = 0;
+    highlight_state = STATE_STARTED;
+    background_stale = false;
+}
+
+/*
+ * Hands the next frame to the render thread. Returns false if it is behind
+ * by a whole ring of frames, in which case the frame is handed over once it
+ * caught up.
+ *
+ */
+static bool post_frame(void) {
+    const unsigned int head = atomic_load_explicit(&frame_queue_head, memory_order_relaxed);
+    const unsigned int tail = atomic_load_explicit(&frame_queue_tail, memory_order_acquire);
+    if (head - tail == FRAME_QUEUE_SIZE) {
+        atomic_store(&frame_queue_full, true);
+        return false;
+    }
+
+    capture_frame(&frame_queue[head % FRAME_QUEUE_SIZE]);
+    atomic_store_explicit(&frame_queue_head, head + 1, memory_order_release);
+    sem_post(&frame_posted);
+    return true;
 }
 
-void *start_time_redraw_tick_pthread(void *arg) {
-    struct timespec *ts = (struct timespec *)arg;
-    while (1) {
-        nanosleep(ts, NULL);
+/*
+ * Draws the frame for all redraws asked for so far, or has the render thread
+ * draw it.
+ *
+ */
+static void draw_frame(void) {
+    const uint32_t reasons = redraw_reasons;
+    if (render_thread_running) {
+        if (!post_frame())
+            return;
+    } else {
+        capture_frame(&frame);
         redraw_screen();
     }
+
+    frames_drawn++;
+    for (int i = 0; i < REDRAW_REASONS; i++) {
+        if (reasons & (1 << i))
+            redraw_frames[i]++;
+    }
+    DEBUG("frame %u for reasons 0x%02x\n", frames_drawn, reasons);
+    last_frame = ev_time();
+}
+
+static void frame_delay_cb(EV_P_ ev_timer *w, int revents) {
+    /* frame_prepare_cb draws the frame, this only wakes up the loop */
+}
+
+/* Has frame_prepare_cb run again after @wait seconds. */
+static void wake_up_in(double wait) {
+    ev_timer_stop(frame_loop, &frame_delay);
+    ev_timer_set(&frame_delay, wait, 0.);
+    ev_timer_start(frame_loop, &frame_delay);
+}
+
+/*
+ * Draws the frame, if any redraw was asked for during this iteration of the
+ * event loop, unless --max-fps or Present want it to wait.
+ *
+ */
+static void frame_prepare_cb(EV_P_ ev_prepare *w, int revents) {
+    if (redraw_reasons == 0)
+        return;
+    if (!frame_ready()) {
+        /* wake up for give_up_present if the X server never answers */
+        if (present_pending)
+            wake_up_in(fmax(present_sent + PRESENT_TIMEOUT - ev_time(), 0) + 0.001);
+        return;
+    }
+
+    if (max_fps > 0) {
+        const double wait = last_frame + 1 / max_fps - ev_time();
+        if (wait > 0) {
+            wake_up_in(wait);
+            return;
+        }
+    }
+    draw_frame();
+}
+
+/*
+ * Asks for a frame to be drawn. Everything asked for during one iteration of
+ * the event loop is drawn as one frame, right before the loop waits for
+ * events again. The main loop must run for this, see redraw_now otherwise.
+ *
+ */
+void schedule_redraw(redraw_reason_t reason) {
+    for (int i = 0; i < REDRAW_REASONS; i++) {
+        if (reason & (1 << i))
+            redraw_requests[i]++;
+    }
+    redraw_reasons |= reason;
+    if (unlock_state == STATE_KEY_ACTIVE || unlock_state == STATE_BACKSPACE_ACTIVE)
+        highlight_state = unlock_state;
+}
+
+/*
+ * Draws a frame right away, together with everything scheduled so far. For
+ * when the main loop is not running or about to be blocked, like during
+ * authentication, so this does not wait for Present like frame_prepare_cb.
+ *
+ */
+void redraw_now(redraw_reason_t reason) {
+    schedule_redraw(reason);
+    /* only for give_up_present */
+    frame_ready();
+    draw_frame();
+}
+
+void start_frame_scheduler(struct ev_loop *loop) {
+    frame_loop = loop;
+    ev_timer_init(&frame_delay, frame_delay_cb, 0., 0.);
+    ev_prepare_init(&frame_prepare, frame_prepare_cb);
+    ev_prepare_start(loop, &frame_prepare);
+}
+
+/*
+ * Prints how many redraws were asked for per reason and how many frames were
+ * drawn for them, with --debug.
+ *
+ */
+void print_redraw_stats(void) {
+    static const char *names[REDRAW_REASONS] = {
+        "input", "auth", "tick", "gif", "background", "resize", "keymap"};
+
+    DEBUG("%u frames drawn\n", frames_drawn);
+    for (int i = 0; i < REDRAW_REASONS; i++)
+        DEBUG("%-10s %6u requests, in %6u frames\n", names[i], redraw_requests[i], redraw_frames[i]);
+}
+
+static void frame_queue_drained_cb(EV_P_ ev_async *w, int revents) {
+    /* frame_prepare_cb posts the frame that did not fit */
+}
+
+/*
+ * Draws the frames the main loop posts, always the latest one, together with
+ * the reasons of the ones it skipped. If the clock, the bar or a slideshow
+ * are shown, the last frame is also drawn again every --refresh-rate seconds,
+ * which goes on while the main loop is blocked authenticating.
+ *
+ */
+static void *render_thread(void *arg) {
+    bool drawn = false;
+
+    while (!atomic_load(&render_thread_stop)) {
+        int ret;
+        if (render_thread_tick && drawn) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            const double seconds = deadline.tv_sec + deadline.tv_nsec / 1e9 + refresh_rate;
+            deadline.tv_sec = (time_t)seconds;
+            deadline.tv_nsec = (long)((seconds - deadline.tv_sec) * 1e9);
+            ret = sem_timedwait(&frame_posted, &deadline);
+        } else {
+            ret = sem_wait(&frame_posted);
+        }
+        if (atomic_load(&render_thread_stop))
+            break;
+
+        unsigned int tail = atomic_load_explicit(&frame_queue_tail, memory_order_relaxed);
+        const unsigned int head = atomic_load_explicit(&frame_queue_head, memory_order_acquire);
+        if (tail == head) {
+            /* a post whose frame was drawn already, or the tick */
+            if (ret == 0 || errno != ETIMEDOUT)
+                continue;
+            frame.reasons = REDRAW_TICK;
+            frame.new_background = false;
+            /* the key press was highlighted once already */
+            if (frame.unlock_state == STATE_KEY_ACTIVE || frame.unlock_state == STATE_BACKSPACE_ACTIVE)
+                frame.unlock_state = STATE_KEY_PRESSED;
+        } else {
+            uint32_t reasons = 0;
+            bool new_background = false;
+            for (; tail != head; tail++) {
+                reasons |= frame_queue[tail % FRAME_QUEUE_SIZE].reasons;
+                new_background |= frame_queue[tail % FRAME_QUEUE_SIZE].new_background;
+            }
+            frame = frame_queue[(head - 1) % FRAME_QUEUE_SIZE];
+            frame.reasons = reasons;
+            frame.new_background = new_background;
+            atomic_store_explicit(&frame_queue_tail, tail, memory_order_release);
+            if (atomic_exchange(&frame_queue_full, false))
+                ev_async_send(frame_loop, &frame_queue_drained);
+        }
+
+        redraw_screen();
+        drawn = true;
+
+        /* nobody else reads errors from this connection */
+        xcb_generic_event_t *event;
+        while ((event = xcb_poll_for_event(render_conn)) != NULL)
+            free(event);
+    }
     return NULL;
 }
 
+/*
+ * Starts the render thread for --redraw-thread, with an X connection of its
+ * own. Frames are drawn on the main thread if that is not possible. @tick
+ * says whether frames must be drawn every --refresh-rate seconds.
+ *
+ */
+void start_render_thread(bool tick) {
+    static xcb_connection_t *thread_conn = NULL;
+    render_thread_tick = tick;
+
+    if (thread_conn == NULL) {
+        thread_conn = xcb_connect(NULL, NULL);
+        if (xcb_connection_has_error(thread_conn)) {
+            DEBUG("cannot connect the render thread to X, drawing on the main thread\n");
+            xcb_disconnect(thread_conn);
+            thread_conn = NULL;
+            return;
+        }
+        /* the pixmaps and surfaces so far were made on conn */
+        release_render_surfaces();
+        render_conn = thread_conn;
+        /* Present tells conn when a frame was shown, not this one */
+        if (present_opcode)
+            DEBUG("not using Present with --redraw-thread\n");
+        present_opcode = 0;
+
+        sem_init(&frame_posted, 0, 0);
+        ev_async_init(&frame_queue_drained, frame_queue_drained_cb);
+        ev_async_start(frame_loop, &frame_queue_drained);
+    }
+
+    atomic_store(&render_thread_stop, false);
+    if (pthread_create(&render_thread_id, NULL, render_thread, NULL) != 0) {
+        DEBUG("could not start the render thread, drawing on the main thread\n");
+        return;
+    }
+    render_thread_running = true;
+}
+
+/*
+ * Stops the render thread after the frame it is drawing, so that the main
+ * thread can change what it draws from, like the monitors, or fork().
+ * Frames posted but not drawn are drawn once it runs again. Returns whether
+ * the thread was running, see resume_render_thread.
+ *
+ */
+bool pause_render_thread(void) {
+    if (!render_thread_running)
+        return false;
+
+    atomic_store(&render_thread_stop, true);
+    sem_post(&frame_posted);
+    pthread_join(render_thread_id, NULL);
+    render_thread_running = false;
+
+    unsigned int tail = atomic_load(&frame_queue_tail);
+    const unsigned int head = atomic_load(&frame_queue_head);
+    for (; tail != head; tail++) {
+        redraw_reasons |= frame_queue[tail % FRAME_QUEUE_SIZE].reasons;
+        background_stale |= frame_queue[tail % FRAME_QUEUE_SIZE].new_background;
+    }
+    atomic_store(&frame_queue_tail, tail);
+    atomic_store(&frame_queue_full, false);
+    /* the semaphore may still count frames that are gone now */
+    while (sem_trywait(&frame_posted) == 0)
+        ;
+    return true;
+}
+
+void resume_render_thread(void) {
+    start_render_thread(render_thread_tick);
+}
+
 static void time_redraw_cb(struct ev_loop *loop, ev_periodic *w, int revents) {
-    redraw_screen();
+    schedule_redraw(REDRAW_TICK);
 }
 
 void start_time_redraw_tick(struct ev_loop *main_loop) {
@@ -24,6 +24,39 @@ typedef enum {
     STATE_I3LOCK_LOCK_FAILED = 4, /* i3lock failed to load */
 } auth_state_t;
 
+/* Why a frame is drawn, see schedule_redraw. */
+typedef enum {
+    REDRAW_INPUT = 1 << 0,      /* a key was pressed or the indicator hidden */
+    REDRAW_AUTH = 1 << 1,       /* auth_state changed */
+    REDRAW_TICK = 1 << 2,       /* the clock, the bar or the slideshow */
+    REDRAW_GIF = 1 << 3,        /* the next frame of a GIF background */
+    REDRAW_BACKGROUND = 1 << 4, /* the blur is done or the fade went on */
+    REDRAW_RESIZE = 1 << 5,     /* the screen or the monitors changed */
+    REDRAW_KEYMAP = 1 << 6,     /* the keyboard layout changed */
+} redraw_reason_t;
+
+#define REDRAW_REASONS 7
+
+/* What render_lock draws a frame from, copied from the main loop's state
+ * when the frame is scheduled, so that --redraw-thread can draw it while the
+ * main loop goes on. */
+typedef struct {
+    uint32_t reasons;
+    unlock_state_t unlock_state;
+    auth_state_t auth_state;
+    int failed_attempts;
+    int blur_bg_count;
+    cairo_surface_t **blur_bg_imgs;
+    cairo_surface_t *img;
+    /* img, blur_bg_count or blur_bg_imgs changed since the last frame */
+    bool new_background;
+    /* the last invalidate_background this frame shows */
+    unsigned int background_serial;
+    bool show_modifiers, show_layout;
+    char modifiers[512];
+    char layout[512];
+} frame_t;
+
 typedef struct {
     text_t status_text;
     text_t mod_text;
@@ -38,6 +71,23 @@ typedef struct {
     double bar_x, bar_y, bar_width;
 } DrawData;
 
+/* Where everything is drawn on one monitor, as given by the position
+ * expressions. */
+typedef struct {
+    double screen_x, screen_y;
+    double indicator_x, indicator_y;
+    double time_x, time_y;
+    double date_x, date_y;
+    double layout_x, layout_y;
+    double greeter_x, greeter_y;
+    /* the status text is placed depending on auth_state */
+    double status_x, status_y;
+    double verif_x, verif_y;
+    double wrong_x, wrong_y;
+    double mod_x, mod_y;
+    double bar_x, bar_y, bar_width;
+} layout_t;
+
 typedef enum {
     NONE,
     TILE,
@@ -64,11 +114,23 @@ typedef struct {
 } control_char_config_t;
 
 void render_lock(uint32_t* resolution, xcb_drawable_t drawable);
+void release_render_surfaces(void);
+void invalidate_layout(void);
+unsigned int invalidate_background(void);
+bool background_shown(unsigned int serial);
 void draw_image(uint32_t* resolution, cairo_surface_t* img, cairo_t* xcb_ctx);
 void init_colors_once(void);
 void redraw_screen(void);
+void schedule_redraw(redraw_reason_t reason);
+void redraw_now(redraw_reason_t reason);
+void start_frame_scheduler(struct ev_loop *loop);
+void print_redraw_stats(void);
+void start_present(void);
+void handle_present_event(xcb_generic_event_t *event);
 void clear_indicator(void);
 void start_time_redraw_timeout(void);
-void* start_time_redraw_tick_pthread(void* arg);
 void start_time_redraw_tick(struct ev_loop* main_loop);
+void start_render_thread(bool tick);
+bool pause_render_thread(void);
+void resume_render_thread(void);
 #endif
@@ -13,6 +13,9 @@
 #include <xcb/xcb_atom.h>
 #include <xcb/xcb_aux.h>
 #include <xcb/composite.h>
+#include <xcb/shm.h>
+#include <xcb/render.h>
+#include <xcb/present.h>
 #include <xcb/xkb.h>
 #include <xkbcommon/xkbcommon.h>
 #include <xkbcommon/xkbcommon-x11.h>
@@ -21,10 +24,14 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <math.h>
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 
 #include "cursors.h"
 #include "i3lock.h"
@@ -278,7 +285,7 @@ bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb
 
     const suseconds_t screen_redraw_timeout = 100000; /* 100ms */
 
-    /* Using few variables to trigger a redraw_screen() if too many tries */
+    /* Using few variables to trigger a redraw_now() if too many tries */
     bool redrawn = false;
     struct timeval start;
     if (gettimeofday(&start, NULL) == -1) {
@@ -320,7 +327,7 @@ bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb
         if (!redrawn &&
             (tries % 100) == 0 &&
             elapsed.tv_usec >= screen_redraw_timeout) {
-            redraw_screen();
+            redraw_now(REDRAW_AUTH);
             redrawn = true;
         }
     }
@@ -358,7 +365,7 @@ bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb
         if (!redrawn &&
             (tries % 100) == 0 &&
             elapsed.tv_usec >= screen_redraw_timeout) {
-            redraw_screen();
+            redraw_now(REDRAW_AUTH);
             redrawn = true;
         }
     }
@@ -493,20 +500,380 @@ void set_focused_window(xcb_connection_t *conn, const xcb_window_t root, const x
     xcb_flush(conn);
 }
 
-xcb_pixmap_t capture_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t * resolution) {
+/*
+ * Copies the width x height area of the root window at (x, y) into a new
+ * pixmap of the same size.
+ *
+ */
+xcb_pixmap_t capture_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, int16_t x, int16_t y, uint16_t width, uint16_t height) {
     xcb_pixmap_t bg_pixmap = xcb_generate_id(conn);
-    xcb_create_pixmap(conn, scr->root_depth, bg_pixmap, scr->root, resolution[0], resolution[1]);
+    xcb_create_pixmap(conn, scr->root_depth, bg_pixmap, scr->root, width, height);
     xcb_gcontext_t gc = xcb_generate_id(conn);
     uint32_t values[] = { scr->black_pixel, 1};
     xcb_create_gc(conn, gc, bg_pixmap, XCB_GC_FOREGROUND | XCB_GC_SUBWINDOW_MODE, values);
-    xcb_rectangle_t rect = { 0, 0, resolution[0], resolution[1] };
+    xcb_rectangle_t rect = { 0, 0, width, height };
     xcb_poly_fill_rectangle(conn, bg_pixmap, gc, 1, &rect);
-    xcb_copy_area(conn, scr->root, bg_pixmap, gc, 0, 0, 0, 0, resolution[0], resolution[1]);
+    xcb_copy_area(conn, scr->root, bg_pixmap, gc, x, y, 0, 0, width, height);
     xcb_flush(conn);
     xcb_free_gc(conn, gc);
     return bg_pixmap;
 }
 
+/*
+ * Returns true if the root window's pixels can be read as they are into a
+ * CAIRO_FORMAT_RGB24 image, that is 32 bits per pixel in host byte order
+ * with the 8 bit red, green and blue channels in the low 24 bits.
+ *
+ */
+bool root_format_is_rgb24(xcb_connection_t *conn, xcb_screen_t *scr) {
+    const xcb_setup_t *setup = xcb_get_setup(conn);
+    const uint32_t one = 1;
+    const bool host_lsb_first = (*(const uint8_t *)&one == 1);
+
+    if (scr->root_depth != 24 && scr->root_depth != 32)
+        return false;
+    if ((setup->image_byte_order == XCB_IMAGE_ORDER_LSB_FIRST) != host_lsb_first)
+        return false;
+
+    xcb_visualtype_t *visual = get_root_visual_type(scr);
+    if (visual == NULL || visual->red_mask != 0xff0000 ||
+        visual->green_mask != 0x00ff00 || visual->blue_mask != 0x0000ff)
+        return false;
+
+    xcb_format_iterator_t iter;
+    for (iter = xcb_setup_pixmap_formats_iterator(setup); iter.rem; xcb_format_next(&iter)) {
+        if (iter.data->depth == scr->root_depth)
+            return iter.data->bits_per_pixel == 32;
+    }
+    return false;
+}
+
+/*
+ * Copies the width x height area of the root window at (x, y) into a shared
+ * memory segment using MIT-SHM, so that the X server writes the pixels
+ * straight into our memory instead of sending them through the socket.
+ *
+ * Returns the pixels (32 bits per pixel, as for CAIRO_FORMAT_RGB24, with a
+ * stride of width * 4), which have to be released with release_bg_shm(), or
+ * NULL if MIT-SHM or the root window's pixel format are not supported. The
+ * caller then falls back to capture_bg_pixmap().
+ *
+ */
+uint32_t *capture_bg_shm(xcb_connection_t *conn, xcb_screen_t *scr, int16_t x, int16_t y, uint16_t width, uint16_t height) {
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn, &xcb_shm_id);
+    if (extension == NULL || !extension->present) {
+        DEBUG("MIT-SHM is not available\n");
+        return NULL;
+    }
+    if (!root_format_is_rgb24(conn, scr)) {
+        DEBUG("root window pixel format does not match CAIRO_FORMAT_RGB24, not using MIT-SHM\n");
+        return NULL;
+    }
+
+    const size_t size = (size_t)width * height * 4;
+    int shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (shmid == -1) {
+        DEBUG("shmget(%zu) failed: %s\n", size, strerror(errno));
+        return NULL;
+    }
+    uint32_t *data = shmat(shmid, NULL, 0);
+    if (data == (void *)-1) {
+        DEBUG("shmat failed: %s\n", strerror(errno));
+        shmctl(shmid, IPC_RMID, NULL);
+        return NULL;
+    }
+
+    xcb_shm_seg_t seg = xcb_generate_id(conn);
+    xcb_generic_error_t *error = xcb_request_check(conn, xcb_shm_attach_checked(conn, seg, shmid, false));
+    if (error == NULL) {
+        xcb_shm_get_image_cookie_t cookie = xcb_shm_get_image(conn, scr->root, x, y, width, height, ~0,
+                                                              XCB_IMAGE_FORMAT_Z_PIXMAP, seg, 0);
+        xcb_shm_get_image_reply_t *reply = xcb_shm_get_image_reply(conn, cookie, &error);
+        if (reply != NULL && reply->size < size) {
+            DEBUG("MIT-SHM returned %u bytes, expected %zu\n", reply->size, size);
+            free(reply);
+            reply = NULL;
+        }
+        xcb_shm_detach(conn, seg);
+        if (reply == NULL) {
+            free(error);
+            error = NULL;
+            shmdt(data);
+            data = NULL;
+        }
+        free(reply);
+    } else {
+        /* e.g. when the X server runs on a different host */
+        DEBUG("could not attach the MIT-SHM segment (X11 error %d)\n", error->error_code);
+        free(error);
+        shmdt(data);
+        data = NULL;
+    }
+
+    /* The segment is freed once our mapping is gone, too. */
+    shmctl(shmid, IPC_RMID, NULL);
+    return data;
+}
+
+/*
+ * Releases pixels returned by capture_bg_shm(). Matches cairo_destroy_func_t,
+ * so it can be attached to the image surface wrapping them.
+ *
+ */
+void release_bg_shm(void *data) {
+    shmdt(data);
+}
+
+/*
+ * Allocates @size bytes of shared memory for put_bg_image() and attaches them
+ * to the X server as *@seg. Returns NULL if MIT-SHM cannot be used, in which
+ * case the caller allocates the pixels itself and put_bg_image() sends them
+ * through the socket. Release with destroy_bg_shm().
+ *
+ */
+uint32_t *create_bg_shm(xcb_connection_t *conn, size_t size, xcb_shm_seg_t *seg) {
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn, &xcb_shm_id);
+    if (extension == NULL || !extension->present)
+        return NULL;
+
+    int shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (shmid == -1) {
+        DEBUG("shmget(%zu) failed: %s\n", size, strerror(errno));
+        return NULL;
+    }
+    uint32_t *data = shmat(shmid, NULL, 0);
+    if (data == (void *)-1) {
+        DEBUG("shmat failed: %s\n", strerror(errno));
+        shmctl(shmid, IPC_RMID, NULL);
+        return NULL;
+    }
+
+    *seg = xcb_generate_id(conn);
+    xcb_generic_error_t *error = xcb_request_check(conn, xcb_shm_attach_checked(conn, *seg, shmid, true));
+    /* The segment is freed once our mapping and the X server's are gone. */
+    shmctl(shmid, IPC_RMID, NULL);
+    if (error != NULL) {
+        DEBUG("could not attach the MIT-SHM segment (X11 error %d)\n", error->error_code);
+        free(error);
+        shmdt(data);
+        return NULL;
+    }
+    return data;
+}
+
+void destroy_bg_shm(xcb_connection_t *conn, xcb_shm_seg_t seg, uint32_t *data) {
+    xcb_shm_detach(conn, seg);
+    shmdt(data);
+}
+
+/*
+ * Writes the width x height pixels @data (laid out as by capture_bg_shm()) to
+ * @pixmap, of the root window's depth, which must be root_format_is_rgb24().
+ * With a @seg from create_bg_shm(), @data is its memory and the X server reads
+ * it from there, otherwise the pixels go through the socket, in as many
+ * requests as needed. Returns once @data can be written to again.
+ *
+ */
+void put_bg_image(xcb_connection_t *conn, xcb_screen_t *scr, xcb_pixmap_t pixmap,
+                  uint16_t width, uint16_t height, const uint32_t *data, xcb_shm_seg_t seg) {
+    xcb_gcontext_t gc = xcb_generate_id(conn);
+    xcb_create_gc(conn, gc, pixmap, 0, NULL);
+
+    if (seg != XCB_NONE) {
+        xcb_generic_error_t *error = xcb_request_check(conn,
+            xcb_shm_put_image_checked(conn, pixmap, gc, width, height, 0, 0, width, height, 0, 0,
+                                      scr->root_depth, XCB_IMAGE_FORMAT_Z_PIXMAP, false, seg, 0));
+        if (error != NULL) {
+            DEBUG("MIT-SHM put image failed (X11 error %d)\n", error->error_code);
+            free(error);
+        }
+    } else {
+        const uint32_t max_length = xcb_get_maximum_request_length(conn) * 4 - sizeof(xcb_put_image_request_t);
+        int rows = max_length / (width * 4);
+        if (rows < 1)
+            rows = 1;
+        for (int y = 0; y < height; y += rows) {
+            const int chunk = (height - y < rows ? height - y : rows);
+            xcb_put_image(conn, XCB_IMAGE_FORMAT_Z_PIXMAP, pixmap, gc, width, chunk, 0, y, 0,
+                          scr->root_depth, (uint32_t)width * chunk * 4, (const uint8_t *)(data + (size_t)width * y));
+        }
+    }
+
+    xcb_free_gc(conn, gc);
+    xcb_flush(conn);
+}
+
+/* libxcb has no name for it, see FilterConvolution in X11/extensions/render.h */
+static const char convolution_filter[] = "convolution";
+
+/*
+ * Returns the XRender picture format of the root window's visual, or 0 if the
+ * X server cannot blur it: that needs the convolution filter (RENDER 0.6) and
+ * PAD repeat, so that the edges do not fade to black (RENDER 0.10).
+ *
+ */
+static xcb_render_pictformat_t xrender_blur_format(xcb_connection_t *conn, xcb_screen_t *scr) {
+    static bool queried = false;
+    static xcb_render_pictformat_t format = 0;
+    if (queried)
+        return format;
+    queried = true;
+
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn, &xcb_render_id);
+    if (extension == NULL || !extension->present) {
+        DEBUG("XRender is not available\n");
+        return 0;
+    }
+
+    xcb_render_query_version_reply_t *version = xcb_render_query_version_reply(
+        conn, xcb_render_query_version(conn, XCB_RENDER_MAJOR_VERSION, XCB_RENDER_MINOR_VERSION), NULL);
+    const bool new_enough = version != NULL && (version->major_version > 0 || version->minor_version >= 10);
+    free(version);
+    if (!new_enough) {
+        DEBUG("XRender is older than 0.10\n");
+        return 0;
+    }
+
+    bool convolution = false;
+    xcb_render_query_filters_reply_t *filters = xcb_render_query_filters_reply(
+        conn, xcb_render_query_filters(conn, scr->root), NULL);
+    if (filters != NULL) {
+        xcb_str_iterator_t iter;
+        for (iter = xcb_render_query_filters_filters_iterator(filters); iter.rem; xcb_str_next(&iter)) {
+            if (xcb_str_name_length(iter.data) == strlen(convolution_filter) &&
+                !memcmp(xcb_str_name(iter.data), convolution_filter, strlen(convolution_filter)))
+                convolution = true;
+        }
+        free(filters);
+    }
+    if (!convolution) {
+        DEBUG("XRender does not support convolution filters\n");
+        return 0;
+    }
+
+    xcb_render_query_pict_formats_reply_t *formats = xcb_render_query_pict_formats_reply(
+        conn, xcb_render_query_pict_formats(conn), NULL);
+    if (formats == NULL)
+        return 0;
+    xcb_render_pictscreen_iterator_t screens;
+    for (screens = xcb_render_query_pict_formats_screens_iterator(formats); screens.rem && !format; xcb_render_pictscreen_next(&screens)) {
+        xcb_render_pictdepth_iterator_t depths;
+        for (depths = xcb_render_pictscreen_depths_iterator(screens.data); depths.rem && !format; xcb_render_pictdepth_next(&depths)) {
+            xcb_render_pictvisual_iterator_t visuals;
+            for (visuals = xcb_render_pictdepth_visuals_iterator(depths.data); visuals.rem; xcb_render_pictvisual_next(&visuals)) {
+                if (visuals.data->visual == scr->root_visual) {
+                    format = visuals.data->format;
+                    break;
+                }
+            }
+        }
+    }
+    free(formats);
+    if (!format)
+        DEBUG("no XRender picture format for the root visual\n");
+    return format;
+}
+
+/*
+ * Returns true if xrender_blur_pixmap() can blur on this X server.
+ *
+ */
+bool xrender_blur_available(xcb_connection_t *conn, xcb_screen_t *scr) {
+    return xrender_blur_format(conn, scr) != 0;
+}
+
+/*
+ * Blurs @pixmap (width x height, of the root window's depth, as returned by
+ * capture_bg_pixmap) in place on the X server, with a horizontal and then a
+ * vertical Gaussian convolution. The pixels never leave the server. Only call
+ * this if xrender_blur_available().
+ *
+ */
+void xrender_blur_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, xcb_pixmap_t pixmap,
+                         uint16_t width, uint16_t height, int sigma) {
+    const xcb_render_pictformat_t format = xrender_blur_format(conn, scr);
+    if (sigma <= 0)
+        return;
+    // the Gaussian is negligible beyond 3 sigma
+    const int radius = 3 * sigma;
+    const int size = 2 * radius + 1;
+    const double variance2 = 2.0 * sigma * sigma;
+
+    /* The filter parameters are the kernel's width and height, followed by
+     * its weights, all in 16.16 fixed point. The weights add up to 1. */
+    xcb_render_fixed_t *params = malloc((size + 2) * sizeof(xcb_render_fixed_t));
+    if (params == NULL)
+        return;
+    xcb_render_fixed_t *weights = params + 2;
+    double total = 0;
+    for (int i = -radius; i <= radius; i++)
+        total += exp(-i * i / variance2);
+    int32_t sum = 0;
+    for (int i = -radius; i <= radius; i++) {
+        weights[i + radius] = lrint(exp(-i * i / variance2) / total * 65536);
+        sum += weights[i + radius];
+    }
+    // rounding must not brighten or darken the image
+    weights[radius] += 65536 - sum;
+
+    xcb_pixmap_t tmp = xcb_generate_id(conn);
+    xcb_create_pixmap(conn, scr->root_depth, tmp, scr->root, width, height);
+
+    const uint32_t repeat[] = {XCB_RENDER_REPEAT_PAD};
+    xcb_render_picture_t picture = xcb_generate_id(conn);
+    xcb_render_picture_t tmp_picture = xcb_generate_id(conn);
+    xcb_render_create_picture(conn, picture, pixmap, format, XCB_RENDER_CP_REPEAT, repeat);
+    xcb_render_create_picture(conn, tmp_picture, tmp, format, XCB_RENDER_CP_REPEAT, repeat);
+
+    params[0] = size << 16;
+    params[1] = 1 << 16;
+    xcb_render_set_picture_filter(conn, picture, strlen(convolution_filter), convolution_filter,
+                                  size + 2, params);
+    xcb_render_composite(conn, XCB_RENDER_PICT_OP_SRC, picture, XCB_NONE, tmp_picture,
+                         0, 0, 0, 0, 0, 0, width, height);
+
+    params[0] = 1 << 16;
+    params[1] = size << 16;
+    xcb_render_set_picture_filter(conn, tmp_picture, strlen(convolution_filter), convolution_filter,
+                                  size + 2, params);
+    xcb_render_composite(conn, XCB_RENDER_PICT_OP_SRC, tmp_picture, XCB_NONE, picture,
+                         0, 0, 0, 0, 0, 0, width, height);
+
+    xcb_render_free_picture(conn, tmp_picture);
+    xcb_render_free_picture(conn, picture);
+    xcb_free_pixmap(conn, tmp);
+    xcb_flush(conn);
+    free(params);
+
+    DEBUG("blurring %dx%d pixels on the X server with sigma %d (%d taps per pass)\n", width, height, sigma, size);
+}
+
+/*
+ * Asks for the Present extension's CompleteNotify and IdleNotify events on
+ * @win. Returns the major opcode of the extension, which these generic events
+ * carry, or 0 if the X server does not support Present.
+ *
+ */
+uint8_t present_select_events(xcb_connection_t *conn, xcb_window_t win) {
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn, &xcb_present_id);
+    if (extension == NULL || !extension->present) {
+        DEBUG("Present is not available\n");
+        return 0;
+    }
+
+    xcb_present_query_version_reply_t *version = xcb_present_query_version_reply(
+        conn, xcb_present_query_version(conn, XCB_PRESENT_MAJOR_VERSION, XCB_PRESENT_MINOR_VERSION), NULL);
+    if (version == NULL) {
+        DEBUG("could not query the Present version\n");
+        return 0;
+    }
+    free(version);
+
+    xcb_present_select_input(conn, xcb_generate_id(conn), win,
+                             XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY | XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+    return extension->major_opcode;
+}
+
 static char * get_atom_name(xcb_connection_t* conn, xcb_atom_t atom) {
     xcb_get_atom_name_reply_t *reply = NULL;
     char *name;
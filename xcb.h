@@ -2,6 +2,7 @@
 #define _XCB_H
 
 #include <xcb/xcb.h>
+#include <xcb/shm.h>
 
 #define all_name_details                                 \
     (XCB_XKB_NAME_DETAIL_KEYCODES |                      \
@@ -31,7 +32,18 @@ bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb
 xcb_cursor_t create_cursor(xcb_connection_t *conn, xcb_screen_t *screen, xcb_window_t win, int choice);
 xcb_window_t find_focused_window(xcb_connection_t *conn, const xcb_window_t root);
 void set_focused_window(xcb_connection_t *conn, const xcb_window_t root, const xcb_window_t window);
-xcb_pixmap_t capture_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t* resolution);
+xcb_pixmap_t capture_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, int16_t x, int16_t y, uint16_t width, uint16_t height);
+uint32_t *capture_bg_shm(xcb_connection_t *conn, xcb_screen_t *scr, int16_t x, int16_t y, uint16_t width, uint16_t height);
+void release_bg_shm(void *data);
+bool root_format_is_rgb24(xcb_connection_t *conn, xcb_screen_t *scr);
+uint32_t *create_bg_shm(xcb_connection_t *conn, size_t size, xcb_shm_seg_t *seg);
+void destroy_bg_shm(xcb_connection_t *conn, xcb_shm_seg_t seg, uint32_t *data);
+void put_bg_image(xcb_connection_t *conn, xcb_screen_t *scr, xcb_pixmap_t pixmap,
+                  uint16_t width, uint16_t height, const uint32_t *data, xcb_shm_seg_t seg);
+bool xrender_blur_available(xcb_connection_t *conn, xcb_screen_t *scr);
+void xrender_blur_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, xcb_pixmap_t pixmap,
+                         uint16_t width, uint16_t height, int sigma);
+uint8_t present_select_events(xcb_connection_t *conn, xcb_window_t win);
 char* xcb_get_key_group_names(xcb_connection_t *conn);
 
 #endif